@@ -64,6 +64,7 @@
 
 #include "p_setup.h"
 #include "r_local.h"
+#include "r_pvs.h"
 
 #include "d_main.h"
 
@@ -859,6 +860,12 @@ void D_DoomMain(void) {
 	printf("Z_Init: Init zone memory allocation daemon. \n");
 	Z_Init();
 
+	// Time the zone allocator on its own
+	if(M_CheckParm("-zonebench")) {
+		Z_Benchmark();
+		exit(0);
+	}
+
 	printf("W_Init: Init WADfiles.\n");
 	W_InitMultipleFiles(wadfiles);
 
@@ -936,6 +943,12 @@ void D_DoomMain(void) {
 	printf("\nP_Init: Init Playloop state.\n");
 	P_Init();
 
+	// Precompute the PVS for all maps, e.g. on a server
+	if(M_CheckParm("-buildpvs")) {
+		R_BuildAllPVS();
+		exit(0);
+	}
+
 	printf("I_Init: Setting up machine state.\n");
 	I_Init();
 
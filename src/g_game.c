@@ -97,6 +97,7 @@ boolean timingdemo; // if true, exit with report on completion
 boolean nodrawers;  // for comparative timing purposes
 boolean noblit;     // for comparative timing purposes
 int starttime;      // for comparative timing purposes
+unsigned startus;   // the same in microseconds
 
 boolean viewactive;
 
@@ -454,6 +455,7 @@ void G_DoLoadLevel(void) {
 	P_SetupLevel(gameepisode, gamemap, 0, gameskill);
 	displayplayer = consoleplayer; // view the guy you are playing
 	starttime = I_GetTime();
+	startus = I_GetTimeUS();
 	gameaction = ga_nothing;
 	Z_CheckHeap();
 
@@ -651,6 +653,8 @@ void G_Ticker(void) {
 
 	case GS_DEMOSCREEN: D_PageTicker(); break;
 	}
+
+	Z_Ticker();
 }
 
 //
@@ -986,6 +990,9 @@ void G_WorldDone(void) {
 		case 20:
 		case 30: F_StartFinale(); break;
 		}
+
+		// The game ends here, no level claims what was read ahead
+		if(gamemap == 30) R_ReleasePreload();
 	}
 }
 
@@ -1381,11 +1388,13 @@ void G_TimeDemo(char *name) {
 
 boolean G_CheckDemoStatus(void) {
 	int endtime;
+	unsigned us;
 
 	if(timingdemo) {
 		endtime = I_GetTime();
-		I_Error(
-		    "timed %i gametics in %i realtics", gametic, endtime - starttime);
+		us = I_GetTimeUS() - startus;
+		I_Error("timed %i gametics in %i realtics, %.1f tics/sec", gametic,
+		    endtime - starttime, us ? gametic * 1000000.0 / us : 0.0);
 	}
 
 	if(demoplayback) {
@@ -54,6 +54,10 @@
 #define HU_INPUTWIDTH 64
 #define HU_INPUTHEIGHT 1
 
+#define HU_ZONEX HU_MSGX
+#define HU_ZONEY (HU_INPUTY + HU_INPUTHEIGHT * (SHORT(hu_font[0]->height) + 1))
+#define HU_ZONEHEIGHT 12
+
 char *chat_macros[] = {HUSTR_CHATMACRO0, HUSTR_CHATMACRO1, HUSTR_CHATMACRO2,
     HUSTR_CHATMACRO3, HUSTR_CHATMACRO4, HUSTR_CHATMACRO5, HUSTR_CHATMACRO6,
     HUSTR_CHATMACRO7, HUSTR_CHATMACRO8, HUSTR_CHATMACRO9};
@@ -78,6 +82,9 @@ static boolean message_nottobefuckedwith;
 static hu_stext_t w_message;
 static int message_counter;
 
+boolean showzonestats;
+static hu_textline_t w_zonestats[HU_ZONEHEIGHT];
+
 extern int showMessages;
 extern boolean automapactive;
 
@@ -295,21 +302,75 @@ void HU_Start(void) {
 	for(i = 0; i < MAXPLAYERS; i++)
 		HUlib_initIText(&w_inputbuffer[i], 0, 0, 0, 0, &always_off);
 
+	// create the zone overlay widgets
+	for(i = 0; i < HU_ZONEHEIGHT; i++) {
+		HUlib_initTextLine(&w_zonestats[i], HU_ZONEX,
+		    HU_ZONEY + i * (SHORT(hu_font[0]->height) + 1), hu_font,
+		    HU_FONTSTART);
+	}
+
 	headsupactive = true;
 }
 
+static void HU_SetZoneLine(int line, char *s) {
+	HUlib_clearTextLine(&w_zonestats[line]);
+	while(*s) HUlib_addCharToTextLine(&w_zonestats[line], *(s++));
+}
+
+static void HU_DrawZoneStats(void) {
+	char buf[HU_MAXLINELENGTH + 1];
+	int i, line;
+
+	sprintf(buf, "zone %iK free %iK purgable %iK", zonestats.mapped >> 10,
+	    zonestats.free >> 10, zonestats.purgable >> 10);
+	HU_SetZoneLine(0, buf);
+
+	sprintf(buf, "largest free %iK, %i%% fragmented", zonestats.largest >> 10,
+	    zonestats.free ?
+	        100 - (int) (100.0 * zonestats.largest / zonestats.free) : 0);
+	HU_SetZoneLine(1, buf);
+
+	sprintf(buf, "tic: %u mallocs %u frees", zonestats.ticmallocs,
+	    zonestats.ticfrees);
+	HU_SetZoneLine(2, buf);
+
+	sprintf(buf, "purged %u blocks, %lluK", zonestats.purges,
+	    zonestats.purgedbytes >> 10);
+	HU_SetZoneLine(3, buf);
+
+	line = 4;
+	for(i = 0; zonetags[i].name && line < HU_ZONEHEIGHT; i++) {
+		if(!zonestats.tagblocks[zonetags[i].tag]) continue;
+
+		sprintf(buf, "%s %iK in %i", zonetags[i].name,
+		    zonestats.tagbytes[zonetags[i].tag] >> 10,
+		    zonestats.tagblocks[zonetags[i].tag]);
+		HU_SetZoneLine(line++, buf);
+	}
+
+	while(line < HU_ZONEHEIGHT) HUlib_clearTextLine(&w_zonestats[line++]);
+
+	for(i = 0; i < HU_ZONEHEIGHT; i++)
+		HUlib_drawTextLine(&w_zonestats[i], false);
+}
+
 void HU_Drawer(void) {
 
 	HUlib_drawSText(&w_message);
 	HUlib_drawIText(&w_chat);
 	if(automapactive) HUlib_drawTextLine(&w_title, false);
+	if(showzonestats) HU_DrawZoneStats();
 }
 
 void HU_Erase(void) {
 
+	int i;
+
 	HUlib_eraseSText(&w_message);
 	HUlib_eraseIText(&w_chat);
 	HUlib_eraseTextLine(&w_title);
+
+	for(i = 0; i < HU_ZONEHEIGHT; i++) HUlib_eraseTextLine(&w_zonestats[i]);
 }
 
 void HU_Ticker(void) {
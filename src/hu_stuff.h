@@ -41,6 +41,9 @@
 
 #define HU_MSGTIMEOUT (4 * TICRATE)
 
+// Zone memory overlay, toggled by idzone
+extern boolean showzonestats;
+
 //
 // HEADS UP TEXT
 //
@@ -0,0 +1,262 @@
+//-----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 by Fabillotic
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+// DESCRIPTION:
+//	Expansion of the 8-bit framebuffer into 32-bit BGRA pixels.
+//	The palette and the scaling are both table driven, the tables
+//	 are only rebuilt when the palette or the window size changes.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLIT_X86
+#endif
+#include "doomdef.h"
+#include "i_blit.h"
+#include "m_bbox.h"
+
+#define BLIT_BLACK 0xff000000u
+
+uint32_t blit_palette[256];
+
+// Destination size
+static int blit_width;
+static int blit_height;
+
+// Destination columns [blit_x1, blit_x2) show the game screen,
+//  blit_cols holds the source column for each of them.
+static int blit_x1;
+static int blit_x2;
+static int *blit_cols;
+
+// Source row offset for every destination row, -1 for black bars.
+static int *blit_rows;
+
+static void (*scalefunc)(byte *src, int *cols, uint32_t *dest, int count);
+static void (*linearfunc)(byte *src, uint32_t *dest, int count);
+
+static void scale_c(byte *src, int *cols, uint32_t *dest, int count) {
+	int i;
+
+	for(i = 0; i < count; i++) dest[i] = blit_palette[src[cols[i]]];
+}
+
+static void linear_c(byte *src, uint32_t *dest, int count) {
+	int i;
+
+	for(i = 0; i < count; i++) dest[i] = blit_palette[src[i]];
+}
+
+#ifdef BLIT_X86
+__attribute__((target("sse2")))
+static void scale_sse2(byte *src, int *cols, uint32_t *dest, int count) {
+	int i;
+	__m128i v;
+
+	for(i = 0; i + 4 <= count; i += 4) {
+		v = _mm_setr_epi32(blit_palette[src[cols[i + 0]]],
+			blit_palette[src[cols[i + 1]]],
+			blit_palette[src[cols[i + 2]]],
+			blit_palette[src[cols[i + 3]]]
+		);
+		_mm_storeu_si128((__m128i *) (dest + i), v);
+	}
+	scale_c(src, cols + i, dest + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void linear_sse2(byte *src, uint32_t *dest, int count) {
+	int i;
+	__m128i v;
+
+	for(i = 0; i + 4 <= count; i += 4) {
+		v = _mm_setr_epi32(blit_palette[src[i + 0]],
+			blit_palette[src[i + 1]],
+			blit_palette[src[i + 2]],
+			blit_palette[src[i + 3]]
+		);
+		_mm_storeu_si128((__m128i *) (dest + i), v);
+	}
+	linear_c(src + i, dest + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(byte *src, int *cols, uint32_t *dest, int count) {
+	int i;
+	__m256i idx, pix;
+	__m256i mask = _mm256_set1_epi32(0xff);
+
+	// The gather reads 4 bytes per column, stop early enough
+	//  to never read past the end of the source row.
+	for(i = 0; i + 8 <= count && cols[i + 7] + 4 <= SCREENWIDTH; i += 8) {
+		idx = _mm256_loadu_si256((__m256i *) (cols + i));
+		pix = _mm256_i32gather_epi32((int *) src, idx, 1);
+		pix = _mm256_and_si256(pix, mask);
+		pix = _mm256_i32gather_epi32((int *) blit_palette, pix, 4);
+		_mm256_storeu_si256((__m256i *) (dest + i), pix);
+	}
+	scale_c(src, cols + i, dest + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void linear_avx2(byte *src, uint32_t *dest, int count) {
+	int i;
+	__m256i pix;
+
+	for(i = 0; i + 8 <= count; i += 8) {
+		pix = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (src + i)));
+		pix = _mm256_i32gather_epi32((int *) blit_palette, pix, 4);
+		_mm256_storeu_si256((__m256i *) (dest + i), pix);
+	}
+	linear_c(src + i, dest + i, count - i);
+}
+#endif
+
+void I_InitBlit() {
+	char *name;
+
+	scalefunc = scale_c;
+	linearfunc = linear_c;
+	name = "C";
+
+#ifdef BLIT_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		scalefunc = scale_avx2;
+		linearfunc = linear_avx2;
+		name = "AVX2";
+	}
+	else if(__builtin_cpu_supports("sse2")) {
+		scalefunc = scale_sse2;
+		linearfunc = linear_sse2;
+		name = "SSE2";
+	}
+#endif
+
+	printf("I_InitBlit: using %s kernels\n", name);
+}
+
+void I_BlitPalette(byte *palette) {
+	int i;
+
+	for(i = 0; i < 256; i++) {
+		blit_palette[i] = BLIT_BLACK
+			| ((uint32_t) palette[i * 3 + 0] << 16)
+			| ((uint32_t) palette[i * 3 + 1] << 8)
+			| ((uint32_t) palette[i * 3 + 2]);
+	}
+}
+
+void I_BlitGeometry(int width, int height, int dx, int dy, int dw, int dh) {
+	int i, x, y;
+
+	blit_width = width;
+	blit_height = height;
+
+	blit_cols = realloc(blit_cols, width * sizeof(int));
+	blit_rows = realloc(blit_rows, height * sizeof(int));
+
+	// Same float math as the old per pixel loop, so the output
+	//  stays exactly the same. Pixels mapping onto SCREENWIDTH or
+	//  SCREENHEIGHT sit on the right/bottom edge and stay black.
+	blit_x1 = -1;
+	blit_x2 = 0;
+	for(i = 0; i < width; i++) {
+		if(i < dx || i > dx + dw) continue;
+		x = (int) (((float) (i - dx)) / dw * SCREENWIDTH);
+		if(x == SCREENWIDTH) continue;
+
+		if(blit_x1 < 0) blit_x1 = i;
+		blit_cols[i - blit_x1] = x;
+		blit_x2 = i + 1;
+	}
+	if(blit_x1 < 0) blit_x1 = 0;
+
+	for(i = 0; i < height; i++) {
+		blit_rows[i] = -1;
+		if(i < dy || i > dy + dh) continue;
+		y = (int) (((float) (i - dy)) / dh * SCREENHEIGHT);
+		if(y == SCREENHEIGHT) continue;
+
+		blit_rows[i] = y * SCREENWIDTH;
+	}
+}
+
+void I_BlitRect(int *box, int *x1, int *y1, int *x2, int *y2) {
+	int i;
+
+	*x1 = blit_x2;
+	*x2 = blit_x1;
+	for(i = blit_x1; i < blit_x2; i++) {
+		if(blit_cols[i - blit_x1] < box[BOXLEFT]) continue;
+		if(blit_cols[i - blit_x1] > box[BOXRIGHT]) break;
+
+		if(*x1 > i) *x1 = i;
+		*x2 = i + 1;
+	}
+
+	*y1 = blit_height;
+	*y2 = 0;
+	for(i = 0; i < blit_height; i++) {
+		if(blit_rows[i] < box[BOXBOTTOM] * SCREENWIDTH) continue;
+		if(blit_rows[i] > box[BOXTOP] * SCREENWIDTH) break;
+
+		if(*y1 > i) *y1 = i;
+		*y2 = i + 1;
+	}
+}
+
+void I_BlitScaled(byte *src, uint32_t *dest, int x1, int y1, int x2, int y2) {
+	int x, y, sx1, sx2;
+	uint32_t *row;
+
+	// Part of the rectangle that shows the game screen
+	sx1 = x1 > blit_x1 ? x1 : blit_x1;
+	sx2 = x2 < blit_x2 ? x2 : blit_x2;
+
+	for(y = y1; y < y2; y++) {
+		row = dest + y * blit_width;
+
+		if(blit_rows[y] < 0) {
+			for(x = x1; x < x2; x++) row[x] = BLIT_BLACK;
+			continue;
+		}
+
+		// Scaled up screens repeat each source row several times
+		if(y > y1 && blit_rows[y] == blit_rows[y - 1]) {
+			memcpy(row + x1, row + x1 - blit_width,
+				(x2 - x1) * sizeof(uint32_t)
+			);
+			continue;
+		}
+
+		for(x = x1; x < sx1; x++) row[x] = BLIT_BLACK;
+		if(sx1 < sx2) {
+			scalefunc(src + blit_rows[y], blit_cols + sx1 - blit_x1,
+				row + sx1, sx2 - sx1
+			);
+		}
+		for(x = sx2 > x1 ? sx2 : x1; x < x2; x++) row[x] = BLIT_BLACK;
+	}
+}
+
+void I_BlitLinear(byte *src, uint32_t *dest, int count) {
+	linearfunc(src, dest, count);
+}
@@ -0,0 +1,52 @@
+//-----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 by Fabillotic
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+// DESCRIPTION:
+//	Expansion of the 8-bit framebuffer into 32-bit BGRA pixels.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __I_BLIT__
+#define __I_BLIT__
+
+#include <stdint.h>
+
+#include "doomtype.h"
+
+// Current palette as 32-bit BGRA words (alpha always 255).
+extern uint32_t blit_palette[256];
+
+// Picks the fastest kernels the CPU supports.
+void I_InitBlit(void);
+
+// Rebuilds blit_palette from 256 (gamma corrected) RGB triples.
+void I_BlitPalette(byte *palette);
+
+// Rebuilds the row/column lookup tables for a width x height
+//  destination with the game screen placed at dx, dy, dw, dh.
+void I_BlitGeometry(int width, int height, int dx, int dy, int dw, int dh);
+
+// Finds the destination rectangle [x1, x2) x [y1, y2) showing the
+//  source pixels inside box (a dirtybox, see m_bbox.h).
+void I_BlitRect(int *box, int *x1, int *y1, int *x2, int *y2);
+
+// Expands the destination rectangle [x1, x2) x [y1, y2) of the
+//  scaled image.
+void I_BlitScaled(byte *src, uint32_t *dest, int x1, int y1, int x2, int y2);
+
+// Expands count pixels 1:1, without any scaling.
+void I_BlitLinear(byte *src, uint32_t *dest, int count);
+
+#endif
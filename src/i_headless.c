@@ -0,0 +1,163 @@
+//-----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 by Fabillotic
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+// DESCRIPTION:
+//	Headless video driver for servers, benchmarks and CI.
+//	Renders into memory only, every Nth frame can be dumped
+//	 as raw RGB or PPM to a file or (with a leading '|') a pipe.
+//
+//	  -headless
+//	  -dumpframes <file|"|command"> [every N]
+//
+//	Files ending in .ppm get a PPM header per frame, everything
+//	 else is written as raw 24-bit RGB.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "doomdef.h"
+#include "doomstat.h"
+#include "i_headless.h"
+#include "i_system.h"
+#include "i_video.h"
+#include "m_argv.h"
+#include "v_video.h"
+
+#ifdef HEADLESS
+boolean headless = true;
+#else
+boolean headless = false;
+#endif
+
+static byte *headless_palette;
+static byte *headless_frame;
+
+static FILE *dumpfile;
+static boolean dumppipe;
+static boolean dumpppm;
+static int dumpevery;
+static int framecount;
+
+void IH_InitGraphics() {
+	char *name;
+	int p, l;
+
+	screens[0] = (unsigned char *) malloc(SCREENWIDTH * SCREENHEIGHT);
+	headless_palette = malloc(256 * 3);
+	memset(headless_palette, 0, 256 * 3);
+
+	framecount = 0;
+	dumpfile = NULL;
+
+	if(!(p = M_CheckParm("-dumpframes")) || p >= myargc - 1) return;
+
+	name = myargv[p + 1];
+	dumpevery = 1;
+	if(p < myargc - 2 && myargv[p + 2][0] != '-')
+		dumpevery = atoi(myargv[p + 2]);
+	if(dumpevery < 1) dumpevery = 1;
+
+	dumppipe = name[0] == '|';
+	if(dumppipe) {
+		dumpfile = popen(name + 1, "w");
+		name++;
+	}
+	else dumpfile = fopen(name, "wb");
+
+	if(!dumpfile) I_Error("IH_InitGraphics: couldn't open %s", name);
+
+	l = strlen(name);
+	dumpppm = l > 4 && !strcmp(name + l - 4, ".ppm");
+
+	headless_frame = malloc(SCREENWIDTH * SCREENHEIGHT * 3);
+
+	printf("IH_InitGraphics: dumping every %d. frame to %s\n",
+		dumpevery, name
+	);
+}
+
+void IH_ShutdownGraphics() {
+	if(!dumpfile) return;
+
+	if(dumppipe) pclose(dumpfile);
+	else fclose(dumpfile);
+	dumpfile = NULL;
+}
+
+void IH_SetPalette(byte *palette) {
+	int i;
+
+	for(i = 0; i < 256 * 3; i++) {
+		headless_palette[i] = gammatable[usegamma][palette[i]];
+	}
+}
+
+void IH_FinishUpdate() {
+	int i;
+	byte *src, *dest;
+
+	if(!dumpfile || framecount++ % dumpevery) return;
+
+	src = screens[0];
+	dest = headless_frame;
+	for(i = 0; i < SCREENWIDTH * SCREENHEIGHT; i++) {
+		memcpy(dest, headless_palette + *src++ * 3, 3);
+		dest += 3;
+	}
+
+	if(dumpppm) {
+		fprintf(dumpfile, "P6\n%d %d\n255\n", SCREENWIDTH, SCREENHEIGHT);
+	}
+	fwrite(headless_frame, 3, SCREENWIDTH * SCREENHEIGHT, dumpfile);
+}
+
+void IH_StartTic() {
+}
+
+#ifdef HEADLESS
+// Built without X11, the headless driver is the only one
+
+void I_InitGraphics() {
+	IH_InitGraphics();
+}
+
+void I_ShutdownGraphics() {
+	IH_ShutdownGraphics();
+}
+
+void I_SetPalette(byte *palette) {
+	IH_SetPalette(palette);
+}
+
+void I_UpdateNoBlit() {
+}
+
+void I_FinishUpdate() {
+	IH_FinishUpdate();
+}
+
+void I_ReadScreen(byte *scr) {
+	memcpy(scr, screens[0], SCREENWIDTH * SCREENHEIGHT);
+}
+
+void I_StartTic() {
+	IH_StartTic();
+}
+
+void I_StartFrame() {
+}
+#endif
@@ -0,0 +1,35 @@
+//-----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 by Fabillotic
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+// DESCRIPTION:
+//	Headless video driver, renders into memory only.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __I_HEADLESS__
+#define __I_HEADLESS__
+
+#include "doomtype.h"
+
+// Set by -headless (or always in builds without X11)
+extern boolean headless;
+
+void IH_InitGraphics(void);
+void IH_ShutdownGraphics(void);
+void IH_SetPalette(byte *palette);
+void IH_FinishUpdate(void);
+void IH_StartTic(void);
+
+#endif
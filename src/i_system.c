@@ -23,11 +23,13 @@
 
 #include <unistd.h>
 #include <stdarg.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 
 #include "doomdef.h"
 #include "i_sound.h"
 #include "i_video.h"
+#include "m_argv.h"
 #include "m_misc.h"
 
 #include "d_net.h"
@@ -54,9 +56,53 @@ int I_GetHeapSize(void) {
 	return mb_used * 1024 * 1024;
 }
 
-byte *I_ZoneBase(int *size) {
-	*size = mb_used * 1024 * 1024;
-	return (byte *) malloc(*size);
+#define HUGEPAGE (2 * 1024 * 1024)
+
+//
+// I_ZoneRegion
+// With -hugepages the region is taken from the reserved huge
+//  pages if there are any, else the kernel is asked to back it
+//  with transparent ones.
+//
+byte *I_ZoneRegion(int *size) {
+	static int hugepages = -1;
+	void *region;
+	int pagesize;
+
+	if(hugepages < 0) hugepages = M_CheckParm("-hugepages") != 0;
+
+#ifdef MAP_HUGETLB
+	if(hugepages) {
+		region = mmap(NULL, (*size + HUGEPAGE - 1) & ~(HUGEPAGE - 1),
+		    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+		    -1, 0);
+
+		if(region != MAP_FAILED) {
+			*size = (*size + HUGEPAGE - 1) & ~(HUGEPAGE - 1);
+			return region;
+		}
+	}
+#endif
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	*size = (*size + pagesize - 1) & ~(pagesize - 1);
+
+	region = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(region == MAP_FAILED) return NULL;
+
+#ifdef MADV_HUGEPAGE
+	if(hugepages) madvise(region, *size, MADV_HUGEPAGE);
+#endif
+
+	return region;
+}
+
+//
+// I_ReleaseZoneRegion
+//
+void I_ReleaseZoneRegion(byte *region, int size) {
+	munmap(region, size);
 }
 
 //
@@ -75,6 +121,18 @@ int I_GetTime(void) {
 	return newtics;
 }
 
+//
+// I_GetTimeUS
+// returns a running time in microseconds, for profiling.
+// Wraps around, only differences mean anything.
+//
+unsigned I_GetTimeUS(void) {
+	struct timeval tp;
+
+	gettimeofday(&tp, NULL);
+	return tp.tv_sec * 1000000u + tp.tv_usec;
+}
+
 //
 // I_Init
 //
@@ -31,15 +31,21 @@
 // Called by DoomMain.
 void I_Init(void);
 
-// Called by startup code
-// to get the ammount of memory to malloc
-// for the zone management.
-byte *I_ZoneBase(int *size);
+// Called by the zone management for more memory.
+// Maps at least *size bytes, *size is set to what was mapped.
+// NULL if there is no more.
+byte *I_ZoneRegion(int *size);
+
+// Gives a region from I_ZoneRegion back to the OS.
+void I_ReleaseZoneRegion(byte *region, int size);
 
 // Called by D_DoomLoop,
 // returns current time in tics.
 int I_GetTime(void);
 
+// Microseconds, for profiling, only differences mean anything.
+unsigned I_GetTimeUS(void);
+
 //
 // Called by D_DoomLoop,
 // called before processing any tics in a frame
@@ -23,9 +23,15 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
+#ifndef OPENGL
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 #ifdef JOYSTICK
 #include <linux/input.h>
 #include <linux/joystick.h>
@@ -39,11 +45,15 @@
 #include "doomdef.h"
 #include "doomstat.h"
 #include "i_video.h"
+#include "i_blit.h"
+#include "i_headless.h"
 #include "m_argv.h"
+#include "m_bbox.h"
 #include "v_video.h"
 #include "m_menu.h"
 
 Display *display;
+Display *pdisplay; // Presentation, a second connection with -presenter
 Window root;
 Window window;
 XVisualInfo visual;
@@ -52,13 +62,41 @@ Colormap colormap;
 #ifndef OPENGL
 GC context;
 XImage *image;
+
+// MIT-SHM, image_data is shared with the X server if use_shm is set
+XShmSegmentInfo shminfo;
+int use_shm;
+int shm_completion;
+int shm_pending;
+int shm_error;
 #else
 GLXContext context;
 int shader;
 int vertexArray;
 int vertexBuffer;
 int texture;
+
+#ifndef GL2
+// The screen is uploaded as a GL_R8 texture, streamed through a ring
+//  of PBOs, and the palette lookup is done by the fragment shader.
+#define NUMPBOS 3
+#define SCREENBYTES (SCREENWIDTH * SCREENHEIGHT)
+
+int palette_texture;
+unsigned int pbos[NUMPBOS];
+GLsync pbo_fences[NUMPBOS];
+byte *pbo_maps[NUMPBOS]; // Persistent mappings, if supported
+int pbo_index;
 #endif
+#endif
+
+// Set whenever blit_palette changed and has to be uploaded again
+int palette_dirty;
+
+// Copy of the last presented frame, only rows that differ from it
+//  get converted and uploaded. present_all forces a full update.
+byte *lastscreen;
+int present_all;
 
 unsigned char *image_data;
 unsigned char *palette;
@@ -70,6 +108,35 @@ int scale;
 int wwidth;
 int wheight;
 
+// Size of the presented image, lags behind the window with -presenter
+int pwidth;
+int pheight;
+
+// -presenter: converting and presenting happens on its own thread.
+// Frames are triple buffered, I_FinishUpdate copies screens[0] and
+//  the palette into frame_fill and swaps it with frame_ready, the
+//  presenter thread swaps frame_ready with frame_shown.
+#define NUMFRAMES 3
+
+typedef struct {
+	byte screen[SCREENWIDTH * SCREENHEIGHT];
+	byte palette[256 * 3];
+	int box[4]; // dirtybox, covers every frame since the last one shown
+} frame_t;
+
+int threaded;
+pthread_t presenter_thread;
+pthread_mutex_t frame_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t frame_cond = PTHREAD_COND_INITIALIZER;
+frame_t frames[NUMFRAMES];
+int frame_fill;
+int frame_ready;
+int frame_shown;
+int frame_new;
+int resize_pending;
+int redraw_pending;
+int presenter_quit;
+
 int fullscreen;
 
 #ifdef JOYTEST
@@ -93,21 +160,42 @@ int joystick_fd;
 		| StructureNotifyMask | FocusChangeMask)
 #define POINTERMASK (ButtonPressMask | ButtonReleaseMask | PointerMotionMask)
 
+void init_presentation();
+void present_frame(byte *screen, int *box);
+boolean changed_region(byte *screen, int *box);
+#if defined(OPENGL) && !defined(GL2)
+void init_pbos();
+void upload_screen(byte *screen, int y1, int y2);
+#endif
+void *presenter(void *arg);
 void make_image();
+#ifndef OPENGL
+int make_shm_image();
+void destroy_image();
+void wait_shm();
+#endif
 void grab_mouse();
 void release_mouse();
 void create_empty_cursor();
 int in_menu();
-void screencoords(int *dx, int *dy, int *dw, int *dh);
+void screencoords(int width, int height, int *dx, int *dy, int *dw, int *dh);
 int xlatekey(KeySym sym);
 
 void I_InitGraphics() {
 	XSetWindowAttributes atts;
 	XEvent ev;
-	XGCValues vals;
 	Atom wm_state, wm_fullscreen;
 	int screen, p;
 
+	if(M_CheckParm("-headless")) {
+		headless = true;
+		IH_InitGraphics();
+		return;
+	}
+
+	threaded = M_CheckParm("-presenter");
+	if(threaded) XInitThreads();
+
 	display = XOpenDisplay(NULL);
 	if(!display) {
 		printf("Couldn't connect to display!\n");
@@ -141,15 +229,7 @@ void I_InitGraphics() {
 	window = XCreateWindow(display, root, 0, 0, wwidth, wheight, 0, 24,
 	    InputOutput, visual.visual,
 	    CWEventMask | CWColormap | CWOverrideRedirect, &atts);
-	context = XCreateGC(display, window, 0, &vals);
 #else
-	Screen *scr = XDefaultScreenOfDisplay(display);
-	XVisualInfo *visual_temp = malloc(sizeof(XVisualInfo));
-	visual_temp->visual = DefaultVisualOfScreen(scr);
-	visual_temp->visualid = XVisualIDFromVisual(visual_temp->visual);
-	visual_temp->screen = screen;
-	visual_temp->depth = DefaultDepthOfScreen(scr);
-
 	XWindowAttributes gwa;
 	XGetWindowAttributes(display, root, &gwa);
 
@@ -186,15 +266,108 @@ void I_InitGraphics() {
 	XMapWindow(display, window);
 	XSync(display, False);
 
-#ifdef OPENGL
+	while(1) {
+		XNextEvent(display, &ev);
+		if(ev.type == Expose && !ev.xexpose.count) break;
+		if(ev.type == ConfigureNotify) {
+			wwidth = ev.xconfigure.width;
+			wheight = ev.xconfigure.height;
+		}
+	}
+	XSelectInput(display, window, EVENTMASK);
+
+	create_empty_cursor();
+
+#ifdef JOYTEST
+	memset(joytest, 0, 8 * sizeof(int));
+#endif
+
+#ifdef JOYSTICK
+	memset(&joystick, 0, sizeof(struct JS_DATA_TYPE));
+
+	joystick_fd = -1;
+	if((p = M_CheckParm("-joystick"))) {
+		if(p < myargc - 1) {
+			joystick_fd = open(myargv[p + 1], O_RDONLY);
+
+			if(joystick_fd < 0) {
+				printf("Failed to open joystick!\n");
+			}
+		}
+	}
+
+#endif
+
+	screens[0] = (unsigned char *) malloc(
+	    SCREENWIDTH * SCREENHEIGHT); // Color index, 8-bit per pixel
+	palette = malloc(256 * 3);       // 256 entries, each of them 24-bit
+	memset(palette, 0, 256 * 3);
+
+	I_InitBlit();
+
+	pwidth = wwidth;
+	pheight = wheight;
+
+	// The presenter gets its own connection, so neither thread
+	//  ever sees the other one's events
+	pdisplay = NULL;
+	if(threaded) pdisplay = XOpenDisplay(DisplayString(display));
+	if(!pdisplay) {
+		threaded = 0;
+		pdisplay = display;
+	}
+
+	if(threaded) {
+		frame_fill = 0;
+		frame_ready = 1;
+		frame_shown = 2;
+		frame_new = 0;
+		resize_pending = 0;
+		redraw_pending = 0;
+		presenter_quit = 0;
+		pthread_create(&presenter_thread, NULL, presenter, NULL);
+	}
+	else init_presentation();
+}
+
+// Sets up everything drawing to the window needs, on pdisplay and
+//  on the thread that is going to present.
+void init_presentation() {
+	int screen;
+
+	screen = DefaultScreen(pdisplay);
+
+	lastscreen = malloc(SCREENWIDTH * SCREENHEIGHT);
+	present_all = 1;
+
+#ifndef OPENGL
+	XGCValues vals;
+
+	XMatchVisualInfo(pdisplay, screen, 24, TrueColor, &visual);
+	context = XCreateGC(pdisplay, window, 0, &vals);
+
+	use_shm = !M_CheckParm("-noshm") && XShmQueryExtension(pdisplay);
+	shm_completion = XShmGetEventBase(pdisplay) + ShmCompletion;
+	shm_pending = 0;
+
+	image = NULL;
+	image_data = NULL;
+#else
+	Screen *scr = XDefaultScreenOfDisplay(pdisplay);
+	XVisualInfo *visual_temp = malloc(sizeof(XVisualInfo));
+	visual_temp->visual = DefaultVisualOfScreen(scr);
+	visual_temp->visualid = XVisualIDFromVisual(visual_temp->visual);
+	visual_temp->screen = screen;
+	visual_temp->depth = DefaultDepthOfScreen(scr);
+
 	int r;
-	XVisualInfo *visual_info = XGetVisualInfo(display, VisualIDMask \
+	XVisualInfo *visual_info = XGetVisualInfo(pdisplay, VisualIDMask \
 		| VisualScreenMask | VisualDepthMask, visual_temp, &r
 	);
 	free(visual_temp);
 
-	context = glXCreateContext(display, visual_info, NULL, 1);
-	glXMakeCurrent(display, window, context);
+	context = glXCreateContext(pdisplay, visual_info, NULL, 1);
+	glXMakeCurrent(pdisplay, window, context);
 
 	int err = glewInit();
 	if(err != GLEW_OK) {
@@ -220,7 +393,11 @@ void I_InitGraphics() {
 		in vec2 uv;\n\
 		out vec3 color;\n\
 		uniform sampler2D tex;\n\
-		void main() {color = texture(tex, uv).rgb;}\n\
+		uniform sampler2D pal;\n\
+		void main() {\n\
+			int i = int(texture(tex, uv).r * 255.0 + 0.5);\n\
+			color = texelFetch(pal, ivec2(i, 0), 0).rgb;\n\
+		}\n\
 		"
 	);
 
@@ -248,69 +425,201 @@ void I_InitGraphics() {
 	glBindTexture(GL_TEXTURE_2D, texture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+#ifndef GL2
+	// Storage is allocated once, frames only update it
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, SCREENWIDTH, SCREENHEIGHT, 0,
+		GL_RED, GL_UNSIGNED_BYTE, NULL
+	);
+
+	glActiveTexture(GL_TEXTURE1);
+	glGenTextures(1, &palette_texture);
+	glBindTexture(GL_TEXTURE_2D, palette_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, 256, 1, 0,
+		GL_BGRA, GL_UNSIGNED_BYTE, blit_palette
+	);
+	glActiveTexture(GL_TEXTURE0);
+
+	glUseProgram(shader);
+	glUniform1i(glGetUniformLocation(shader, "tex"), 0);
+	glUniform1i(glGetUniformLocation(shader, "pal"), 1);
+
+	init_pbos();
+#else
+	image_data = malloc(SCREENWIDTH * SCREENHEIGHT * 4);
+#endif
+	glViewport(0, 0, pwidth, pheight);
 #endif
 
+	make_image();
+}
+
+void *presenter(void *arg) {
+	int i, resize;
+	int box[4];
+	byte lastpal[256 * 3];
+
+	init_presentation();
+	memset(lastpal, 0, 256 * 3);
+	I_BlitPalette(lastpal);
+
 	while(1) {
-		XNextEvent(display, &ev);
-		if(ev.type == Expose && !ev.xexpose.count) break;
-		if(ev.type == ConfigureNotify) {
-			wwidth = ev.xconfigure.width;
-			wheight = ev.xconfigure.height;
+		pthread_mutex_lock(&frame_mutex);
+		while(!frame_new && !presenter_quit) {
+			pthread_cond_wait(&frame_cond, &frame_mutex);
+		}
+		if(presenter_quit) {
+			pthread_mutex_unlock(&frame_mutex);
+			break;
 		}
-	}
-	XSelectInput(display, window, EVENTMASK);
 
-	create_empty_cursor();
+		i = frame_shown;
+		frame_shown = frame_ready;
+		frame_ready = i;
+		frame_new = 0;
 
-#ifdef JOYTEST
-	memset(joytest, 0, 8 * sizeof(int));
-#endif
+		memcpy(box, frames[frame_shown].box, sizeof(box));
 
-#ifdef JOYSTICK
-	memset(&joystick, 0, sizeof(struct JS_DATA_TYPE));
+		resize = resize_pending;
+		if(resize) {
+			pwidth = wwidth;
+			pheight = wheight;
+			resize_pending = 0;
+		}
+		if(redraw_pending) {
+			present_all = 1;
+			redraw_pending = 0;
+		}
+		pthread_mutex_unlock(&frame_mutex);
 
-	joystick_fd = -1;
-	if((p = M_CheckParm("-joystick"))) {
-		if(p < myargc - 1) {
-			joystick_fd = open(myargv[p + 1], O_RDONLY);
+		if(resize) {
+			make_image();
+#ifdef OPENGL
+			glViewport(0, 0, pwidth, pheight);
+#endif
+		}
 
-			if(joystick_fd < 0) {
-				printf("Failed to open joystick!\n");
-			}
+		// The palette travels with the frame
+		if(memcmp(lastpal, frames[frame_shown].palette, 256 * 3)) {
+			memcpy(lastpal, frames[frame_shown].palette, 256 * 3);
+			I_BlitPalette(lastpal);
+			palette_dirty = 1;
+			present_all = 1;
 		}
-	}
 
-#endif
+		present_frame(frames[frame_shown].screen, box);
+	}
 
-	screens[0] = (unsigned char *) malloc(
-	    SCREENWIDTH * SCREENHEIGHT); // Color index, 8-bit per pixel
-	palette = malloc(256 * 3);       // 256 entries, each of them 24-bit
+	return NULL;
+}
 
-	image_data = NULL;
+void make_image() {
+	present_all = 1;
 
 #ifndef OPENGL
-	image = NULL;
-#else
-	image_data = malloc(SCREENWIDTH * SCREENHEIGHT * 3);
-	glViewport(0, 0, wwidth, wheight);
-#endif
+	int dx, dy, dw, dh;
 
-	make_image();
+	if(image) destroy_image();
+
+	if(use_shm && !make_shm_image()) {
+		printf("XShm unavailable, falling back to XPutImage\n");
+		use_shm = 0;
+	}
+
+	if(!use_shm) {
+		// RGB, 8-bit each, actually 32-bit per pixel, cause X11 weirdness
+		image_data = malloc(pwidth * pheight * 4);
+		image = XCreateImage(pdisplay, visual.visual, 24, ZPixmap, 0,
+		    (char *) image_data, pwidth, pheight, 8, 4 * pwidth);
+	}
+
+	screencoords(pwidth, pheight, &dx, &dy, &dw, &dh);
+	I_BlitGeometry(pwidth, pheight, dx, dy, dw, dh);
+#endif
 }
 
-void make_image() {
 #ifndef OPENGL
-	if(image) {
+int shm_error_handler(Display *d, XErrorEvent *ev) {
+	shm_error = 1;
+	return 0;
+}
+
+int make_shm_image() {
+	int (*handler)(Display *, XErrorEvent *);
+
+	image = XShmCreateImage(pdisplay, visual.visual, 24, ZPixmap, NULL,
+		&shminfo, pwidth, pheight
+	);
+	if(!image) return 0;
+
+	shminfo.shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height,
+		IPC_CREAT | 0600
+	);
+	if(shminfo.shmid < 0) {
 		XDestroyImage(image);
+		image = NULL;
+		return 0;
 	}
 
-	// RGB, 8-bit each, actually 32-bit per pixel, cause X11 weirdness
-	image_data = malloc(wwidth * wheight * 4);
-	image = XCreateImage(display, visual.visual, 24, ZPixmap, 0,
-	    (char *) image_data, wwidth, wheight, 8, 4 * wwidth);
-#endif
+	shminfo.shmaddr = image->data = shmat(shminfo.shmid, NULL, 0);
+	shminfo.readOnly = False;
+
+	// Remote displays fail the attach with an X error, catch it
+	shm_error = shminfo.shmaddr == (char *) -1;
+	if(!shm_error) {
+		handler = XSetErrorHandler(shm_error_handler);
+		XShmAttach(pdisplay, &shminfo);
+		XSync(pdisplay, False);
+		XSetErrorHandler(handler);
+	}
+
+	// The segment lives on until both sides have detached
+	shmctl(shminfo.shmid, IPC_RMID, NULL);
+
+	if(shm_error) {
+		if(shminfo.shmaddr != (char *) -1) shmdt(shminfo.shmaddr);
+		image->data = NULL;
+		XDestroyImage(image);
+		image = NULL;
+		return 0;
+	}
+
+	image_data = (unsigned char *) image->data;
+	return 1;
 }
 
+void destroy_image() {
+	if(use_shm) {
+		wait_shm();
+		XShmDetach(pdisplay, &shminfo);
+		image->data = NULL; // Not ours to free
+		XDestroyImage(image);
+		shmdt(shminfo.shmaddr);
+	}
+	else XDestroyImage(image);
+
+	image = NULL;
+	image_data = NULL;
+}
+
+Bool is_shm_completion(Display *d, XEvent *ev, XPointer arg) {
+	return ev->type == shm_completion;
+}
+
+// Blocks until the server is done reading the last XShmPutImage
+void wait_shm() {
+	XEvent ev;
+
+	if(!shm_pending) return;
+
+	XIfEvent(pdisplay, &ev, is_shm_completion, NULL);
+	shm_pending = 0;
+}
+#endif
+
 void grab_mouse() {
 	if(!mouse_grabbed)
 		XGrabPointer(display, window, True,
@@ -342,88 +651,200 @@ void create_empty_cursor() {
 }
 
 void I_ShutdownGraphics() {
+	if(headless) {
+		IH_ShutdownGraphics();
+		return;
+	}
+
+	if(threaded) {
+		pthread_mutex_lock(&frame_mutex);
+		presenter_quit = 1;
+		pthread_cond_signal(&frame_cond);
+		pthread_mutex_unlock(&frame_mutex);
+		pthread_join(presenter_thread, NULL);
+		threaded = 0;
+	}
+
+#ifndef OPENGL
+	if(pdisplay && image) destroy_image();
+#endif
 }
 
 void I_SetPalette(byte *pal) {
 	int i;
 
+	if(headless) {
+		IH_SetPalette(pal);
+		return;
+	}
+
 	memcpy(palette, pal, 256 * 3);
 
 	for(i = 0; i < 256 * 3; i++) {
 		palette[i] = gammatable[usegamma][palette[i]];
 	}
+
+	// With -presenter the palette is sent along with the next frame
+	if(!threaded) {
+		I_BlitPalette(palette);
+		palette_dirty = 1;
+		present_all = 1;
+	}
 }
 
 void I_UpdateNoBlit() {
 }
 
 void I_FinishUpdate() {
-	int i, j, k, dw, dh, dx, dy, x, y;
-	float aspect_scale_x, aspect_scale_y;
+	int i;
+	int box[4];
+	frame_t *frame;
 
-#ifdef OPENGL
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
-#endif
+	if(headless) {
+		IH_FinishUpdate();
+		return;
+	}
 
-	screencoords(&dx, &dy, &dw, &dh);
+	memcpy(box, dirtybox, sizeof(box));
+	M_ClearBox(dirtybox);
 
-#ifndef OPENGL
-	for(i = 0; i < wwidth * wheight; i++) {
-		j = i % wwidth;
-		k = i / wwidth;
+	if(!threaded) {
+		present_frame(screens[0], box);
+		return;
+	}
 
-		image_data[i * 4 + 3] = 255;
+	// The renderer only redraws what changed, so screens[0] has to
+	//  stay ours, hand over a copy instead.
+	frame = &frames[frame_fill];
+	memcpy(frame->screen, screens[0], SCREENWIDTH * SCREENHEIGHT);
+	memcpy(frame->palette, palette, 256 * 3);
+	memcpy(frame->box, box, sizeof(box));
 
-		/* Black bars */
-		if(j < dx || j > dx + dw || k < dy || k > dy + dh) {
-			image_data[i * 4 + 0] = 0;
-			image_data[i * 4 + 1] = 0;
-			image_data[i * 4 + 2] = 0;
-		}
-		else {
-			x = (int) (((float) (j - dx)) / dw * SCREENWIDTH);
-			y = (int) (((float) (k - dy)) / dh * SCREENHEIGHT);
-
-			if(x == SCREENWIDTH || y == SCREENHEIGHT) continue;
-
-			image_data[i * 4 + 0] = palette[
-				((int) screens[0][x + SCREENWIDTH * y]) * 3 + 2
-			];
-			image_data[i * 4 + 1] = palette[
-				((int) screens[0][x + SCREENWIDTH * y]) * 3 + 1
-			];
-			image_data[i * 4 + 2] = palette[
-				((int) screens[0][x + SCREENWIDTH * y]) * 3 + 0
-			];
-		}
+	pthread_mutex_lock(&frame_mutex);
+
+	// The presenter skipped the frame we replace, keep its changes
+	if(frame_new) {
+		M_AddToBox(frame->box, frames[frame_ready].box[BOXLEFT],
+			frames[frame_ready].box[BOXBOTTOM]
+		);
+		M_AddToBox(frame->box, frames[frame_ready].box[BOXRIGHT],
+			frames[frame_ready].box[BOXTOP]
+		);
+	}
+
+	i = frame_ready;
+	frame_ready = frame_fill;
+	frame_fill = i;
+	frame_new = 1;
+	pthread_cond_signal(&frame_cond);
+	pthread_mutex_unlock(&frame_mutex);
+}
+
+// Narrows box down to the rows that differ from the last presented
+//  frame and updates that copy. False if there is nothing to do.
+boolean changed_region(byte *screen, int *box) {
+	int y, y1, y2, x, w, ofs;
+
+	if(present_all) {
+		memcpy(lastscreen, screen, SCREENWIDTH * SCREENHEIGHT);
+		box[BOXLEFT] = 0;
+		box[BOXRIGHT] = SCREENWIDTH - 1;
+		box[BOXBOTTOM] = 0;
+		box[BOXTOP] = SCREENHEIGHT - 1;
+		present_all = 0;
+		return true;
 	}
+
+	if(box[BOXLEFT] < 0) box[BOXLEFT] = 0;
+	if(box[BOXRIGHT] >= SCREENWIDTH) box[BOXRIGHT] = SCREENWIDTH - 1;
+	if(box[BOXBOTTOM] < 0) box[BOXBOTTOM] = 0;
+	if(box[BOXTOP] >= SCREENHEIGHT) box[BOXTOP] = SCREENHEIGHT - 1;
+
+	if(box[BOXLEFT] > box[BOXRIGHT] || box[BOXBOTTOM] > box[BOXTOP]) {
+		return false;
+	}
+
+	x = box[BOXLEFT];
+	w = box[BOXRIGHT] - x + 1;
+
+	y1 = -1;
+	y2 = -1;
+	for(y = box[BOXBOTTOM]; y <= box[BOXTOP]; y++) {
+		ofs = y * SCREENWIDTH + x;
+		if(!memcmp(screen + ofs, lastscreen + ofs, w)) continue;
+
+		memcpy(lastscreen + ofs, screen + ofs, w);
+		if(y1 < 0) y1 = y;
+		y2 = y;
+	}
+
+	if(y1 < 0) return false;
+
+	box[BOXBOTTOM] = y1;
+	box[BOXTOP] = y2;
+	return true;
+}
+
+void present_frame(byte *screen, int *box) {
+#ifdef OPENGL
+	float aspect_scale_x, aspect_scale_y;
 #else
-	for(i = 0; i < SCREENWIDTH * SCREENHEIGHT; i++) {
-		x = i % SCREENWIDTH;
-		y = i / SCREENWIDTH;
-		image_data[i * 3 + 0] = palette[
-			((int) screens[0][x + SCREENWIDTH * y]) * 3 + 2
-		];
-		image_data[i * 3 + 1] = palette[
-			((int) screens[0][x + SCREENWIDTH * y]) * 3 + 1
-		];
-		image_data[i * 3 + 2] = palette[
-			((int) screens[0][x + SCREENWIDTH * y]) * 3 + 0
-		];
+	int x1, y1, x2, y2;
+	boolean full;
+
+	full = present_all;
+#endif
+
+	// Nothing changed on static screens, skip the whole update
+	if(!changed_region(screen, box)) return;
+
+#ifdef OPENGL
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+#ifdef GL2
+	I_BlitLinear(screen, (uint32_t *) image_data,
+		SCREENWIDTH * SCREENHEIGHT
+	);
+#endif
+#else
+	// Don't touch the shared image while the server still reads it
+	wait_shm();
+
+	// Black bars only need drawing on full updates
+	if(full) {
+		x1 = y1 = 0;
+		x2 = pwidth;
+		y2 = pheight;
 	}
+	else I_BlitRect(box, &x1, &y1, &x2, &y2);
+
+	if(x1 >= x2 || y1 >= y2) return;
+
+	I_BlitScaled(screen, (uint32_t *) image_data, x1, y1, x2, y2);
 #endif
 
 #ifndef OPENGL
-	XPutImage(display, window, context, image, 0, 0, 0, 0, wwidth, wheight);
-	XSync(display, False);
+	if(use_shm) {
+		XShmPutImage(pdisplay, window, context, image, x1, y1, x1, y1,
+			x2 - x1, y2 - y1, True
+		);
+		XFlush(pdisplay);
+		shm_pending = 1;
+	}
+	else {
+		XPutImage(pdisplay, window, context, image, x1, y1, x1, y1,
+			x2 - x1, y2 - y1
+		);
+		XSync(pdisplay, False);
+	}
 #else
 	aspect_scale_x = (float) SCREENWIDTH / (float) SCREENHEIGHT;
-	aspect_scale_x /= (float) wwidth / (float) wheight;
+	aspect_scale_x /= (float) pwidth / (float) pheight;
 	aspect_scale_y = 1.0f;
 	if(aspect_scale_x > 1.0f) {
 		aspect_scale_y = (float) SCREENHEIGHT / (float) SCREENWIDTH;
-		aspect_scale_y /= (float) wheight / (float) wwidth;
+		aspect_scale_y /= (float) pheight / (float) pwidth;
 		aspect_scale_x = 1.0f;
 	}
 
@@ -432,13 +853,24 @@ void I_FinishUpdate() {
 	glUniform2f(glGetUniformLocation(shader, "aspect_scale"),
 		aspect_scale_x, aspect_scale_y
 	);
+
+	if(palette_dirty) {
+		glActiveTexture(GL_TEXTURE1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 1,
+			GL_BGRA, GL_UNSIGNED_BYTE, blit_palette
+		);
+		glActiveTexture(GL_TEXTURE0);
+		palette_dirty = 0;
+	}
+
+	upload_screen(screen, box[BOXBOTTOM], box[BOXTOP] + 1);
 #else
 	glEnable(GL_TEXTURE_2D);
-#endif
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, SCREENWIDTH, SCREENHEIGHT, 0,
-		GL_BGR, GL_UNSIGNED_BYTE, image_data
+		GL_BGRA, GL_UNSIGNED_BYTE, image_data
 	);
+#endif
 
 #ifndef GL2
 	glEnableVertexAttribArray(0);
@@ -474,10 +906,83 @@ void I_FinishUpdate() {
 	glDisable(GL_TEXTURE_2D);
 #endif
 
-	glXSwapBuffers(display, window);
+	glXSwapBuffers(pdisplay, window);
 #endif
 }
 
+#if defined(OPENGL) && !defined(GL2)
+void init_pbos() {
+	int i, flags;
+
+	flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glGenBuffers(NUMPBOS, pbos);
+	for(i = 0; i < NUMPBOS; i++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+
+		if(GLEW_ARB_buffer_storage) {
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, SCREENBYTES, NULL, flags);
+			pbo_maps[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+				SCREENBYTES, flags
+			);
+		}
+		else {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, SCREENBYTES, NULL,
+				GL_STREAM_DRAW
+			);
+			pbo_maps[i] = NULL;
+		}
+
+		pbo_fences[i] = NULL;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	pbo_index = 0;
+}
+
+// Uploads rows [y1, y2) of the screen
+void upload_screen(byte *screen, int y1, int y2) {
+	byte *dest;
+	GLsync fence;
+	int size;
+
+	size = (y2 - y1) * SCREENWIDTH;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[pbo_index]);
+
+	if(pbo_maps[pbo_index]) {
+		// Wait for the GPU to finish the last upload out of this PBO
+		fence = pbo_fences[pbo_index];
+		if(fence) {
+			while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+				1000000) == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(fence);
+		}
+		dest = pbo_maps[pbo_index];
+	}
+	else {
+		dest = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+		);
+	}
+
+	memcpy(dest, screen + y1 * SCREENWIDTH, size);
+
+	if(!pbo_maps[pbo_index]) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y1, SCREENWIDTH, y2 - y1,
+		GL_RED, GL_UNSIGNED_BYTE, (void *) 0
+	);
+
+	if(pbo_maps[pbo_index]) {
+		pbo_fences[pbo_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	pbo_index = (pbo_index + 1) % NUMPBOS;
+}
+#endif
+
 void I_ReadScreen(byte *scr) {
 	memcpy(scr, screens[0], SCREENWIDTH * SCREENHEIGHT);
 }
@@ -493,6 +998,11 @@ void I_StartTic() {
 	struct JS_DATA_TYPE js_data;
 #endif
 
+	if(headless) {
+		IH_StartTic();
+		return;
+	}
+
 	while(XPending(display)) {
 		XNextEvent(display, &ev);
 
@@ -611,7 +1121,7 @@ void I_StartTic() {
 				}
 			}
 			else {
-				screencoords(&dx, &dy, &dw, &dh);
+				screencoords(wwidth, wheight, &dx, &dy, &dw, &dh);
 				x = (int) (((float) (ev.xmotion.x - dx))
 					/ dw * SCREENWIDTH);
 				y = (int) (((float) (ev.xmotion.y - dy))
@@ -620,14 +1130,38 @@ void I_StartTic() {
 			}
 		}
 		else if(ev.type == ConfigureNotify) {
-			wwidth = ev.xconfigure.width;
-			wheight = ev.xconfigure.height;
+			if(threaded) {
+				// Picked up by the presenter with the next frame
+				pthread_mutex_lock(&frame_mutex);
+				wwidth = ev.xconfigure.width;
+				wheight = ev.xconfigure.height;
+				resize_pending = 1;
+				pthread_mutex_unlock(&frame_mutex);
+				continue;
+			}
+
+			wwidth = pwidth = ev.xconfigure.width;
+			wheight = pheight = ev.xconfigure.height;
 
 			make_image();
 #ifdef OPENGL
-			glViewport(0, 0, wwidth, wheight);
+			glViewport(0, 0, pwidth, pheight);
 #endif
 		}
+		else if(ev.type == Expose) {
+			// The window lost its contents, present everything again
+			if(threaded) {
+				pthread_mutex_lock(&frame_mutex);
+				redraw_pending = 1;
+				pthread_mutex_unlock(&frame_mutex);
+			}
+			else present_all = 1;
+		}
+#ifndef OPENGL
+		else if(ev.type == shm_completion) {
+			shm_pending = 0;
+		}
+#endif
 		else if(ev.type == FocusIn && ev.xfocus.mode == NotifyNormal) {
 			if(ev.xfocus.window == window) {
 				if(!in_menu()) grab_mouse();
@@ -685,22 +1219,22 @@ int in_menu() {
 	return menuactive || gamestate != GS_LEVEL;
 }
 
-void screencoords(int *dx, int *dy, int *dw, int *dh) {
+void screencoords(int width, int height, int *dx, int *dy, int *dw, int *dh) {
 	int x, y, w, h, vert;
 
-	vert = (float) wwidth / wheight < (float) SCREENWIDTH / SCREENHEIGHT;
+	vert = (float) width / height < (float) SCREENWIDTH / SCREENHEIGHT;
 
 	if(!vert) {
-		h = wheight;
+		h = height;
 		w = (int) (((float) h / SCREENHEIGHT) * SCREENWIDTH);
 		y = 0;
-		x = (wwidth - w) / 2;
+		x = (width - w) / 2;
 	}
 	else {
-		w = wwidth;
+		w = width;
 		h = (int) (((float) w / SCREENWIDTH) * SCREENHEIGHT);
 		x = 0;
-		y = (wheight - h) / 2;
+		y = (height - h) / 2;
 	}
 
 	*dx = x;
@@ -0,0 +1,706 @@
+//-----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 by Fabillotic
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+// DESCRIPTION:
+//	Cache of the parsed level geometry.
+//	After a map has been set up the normal way (swapped, texture
+//	 and flat names looked up, P_GroupLines done) its structures
+//	 are written to a file as flat arrays of fixed size records,
+//	 every pointer replaced by an index. The next time the map is
+//	 loaded the file is mapped and the arrays are linked back up,
+//	 no lump is parsed.
+//	The file is named after a hash of the map lumps, the lump
+//	 directory and the texture lists, so anything that could give
+//	 different numbers gets a file of its own. It lives in the
+//	 levelcache directory next to the WAD of the map.
+//
+//	  -levelcache     read and write the cache files
+//
+//-----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "p_cache.h"
+#include "p_local.h"
+#include "w_wad.h"
+#include "z_zone.h"
+
+#define LEVELCACHE_VERSION 1
+
+// Sanity limit for the counts in a header
+#define LEVELCACHE_MAXCOUNT (1 << 24)
+
+typedef struct {
+	char magic[4]; // "DLVL"
+	int version;
+	uint64_t hash;
+
+	int numvertexes;
+	int numsectors;
+	int numsides;
+	int numlines;
+	int numsubsectors;
+	int numnodes;
+	int numsegs;
+	int numsectorlines;
+	int numblockmap;
+
+	// Of the whole file
+	int size;
+} levelheader_t;
+
+// The records, -1 stands for NULL.
+//  vertex_t and node_t hold no pointers and are stored as they are.
+typedef struct {
+	fixed_t floorheight;
+	fixed_t ceilingheight;
+	int floorpic;
+	int ceilingpic;
+	int lightlevel;
+	int special;
+	int tag;
+	int blockbox[4];
+	fixed_t soundx;
+	fixed_t soundy;
+
+	// Into the sector line list
+	int firstline;
+	int linecount;
+} cachesector_t;
+
+typedef struct {
+	fixed_t textureoffset;
+	fixed_t rowoffset;
+	int toptexture;
+	int bottomtexture;
+	int midtexture;
+	int sector;
+} cacheside_t;
+
+typedef struct {
+	int v1;
+	int v2;
+	fixed_t dx;
+	fixed_t dy;
+	int flags;
+	int special;
+	int tag;
+	int sidenum[2];
+	fixed_t bbox[4];
+	int slopetype;
+	int frontsector;
+	int backsector;
+} cacheline_t;
+
+typedef struct {
+	int sector;
+	int numlines;
+	int firstline;
+} cachesubsector_t;
+
+typedef struct {
+	int v1;
+	int v2;
+	fixed_t offset;
+	angle_t angle;
+	int sidedef;
+	int linedef;
+	int frontsector;
+	int backsector;
+} cacheseg_t;
+
+// Lumps that end up in the cache
+static int maplumps[] = {ML_VERTEXES, ML_SECTORS, ML_SIDEDEFS, ML_LINEDEFS,
+    ML_SSECTORS, ML_NODES, ML_SEGS, ML_BLOCKMAP};
+
+static uint64_t P_HashBytes(uint64_t hash, void *data, int length) {
+	byte *p;
+	int i;
+
+	// FNV-1a
+	p = data;
+	for(i = 0; i < length; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+//
+// P_HashResources
+// Texture and flat numbers depend on the lump directory
+//  and the texture lists, hashed once.
+//
+static uint64_t P_HashResources(void) {
+	static boolean hashed;
+	static uint64_t hash;
+	char *lists[] = {"TEXTURE1", "TEXTURE2", "PNAMES"};
+	int i, lump;
+
+	if(hashed) return hash;
+
+	hash = 0xcbf29ce484222325ull;
+	for(i = 0; i < numlumps; i++)
+		hash = P_HashBytes(hash, lumpinfo[i].name, 8);
+
+	for(i = 0; i < sizeof(lists) / sizeof(*lists); i++) {
+		lump = W_CheckNumForName(lists[i]);
+		if(lump == -1) continue;
+
+		hash = P_HashBytes(hash, W_CacheLumpNum(lump, PU_CACHE),
+		    W_LumpLength(lump));
+	}
+
+	hashed = true;
+	return hash;
+}
+
+//
+// P_CacheName
+// Hashes the map at lumpnum and names its cache file.
+//
+static uint64_t P_CacheName(int lumpnum, char *name, int size) {
+	uint64_t hash;
+	char *file, *slash;
+	char dir[1024];
+	int i, lump, length, dirlength;
+
+	hash = P_HashResources();
+	for(i = 0; i < sizeof(maplumps) / sizeof(int); i++) {
+		lump = lumpnum + maplumps[i];
+		length = W_LumpLength(lump);
+		hash = P_HashBytes(hash, &length, sizeof(length));
+		hash = P_HashBytes(hash, W_CacheLumpNum(lump, PU_CACHE), length);
+	}
+
+	file = lumpinfo[lumpnum].wadfile;
+	slash = strrchr(file, '/');
+	dirlength = slash ? slash - file + 1 : 0;
+
+	snprintf(dir, sizeof(dir), "%.*slevelcache", dirlength, file);
+	mkdir(dir, 0755);
+	snprintf(name, size, "%s/%016llx.lvl", dir, (unsigned long long) hash);
+
+	return hash;
+}
+
+static int P_CacheSize(levelheader_t *h) {
+	return sizeof(levelheader_t) + h->numvertexes * sizeof(vertex_t) +
+	       h->numsectors * sizeof(cachesector_t) +
+	       h->numsides * sizeof(cacheside_t) +
+	       h->numlines * sizeof(cacheline_t) +
+	       h->numsubsectors * sizeof(cachesubsector_t) +
+	       h->numnodes * sizeof(node_t) + h->numsegs * sizeof(cacheseg_t) +
+	       h->numsectorlines * sizeof(int) + h->numblockmap * sizeof(short);
+}
+
+//
+// P_CheckCache
+// Everything in a cache file is checked before any of it is used,
+//  a broken file just means the map is parsed again.
+//
+#define BADINDEX(i, count, null) ((i) < ((null) ? -1 : 0) || (i) >= (count))
+
+static boolean P_CheckCache(byte *data, int size, uint64_t hash) {
+	levelheader_t *h;
+	cachesector_t *sector;
+	cacheside_t *side;
+	cacheline_t *line;
+	cachesubsector_t *sub;
+	node_t *node;
+	cacheseg_t *seg;
+	int *sectorlines;
+	short *bmap;
+	int i, j, child, ofs;
+
+	h = (levelheader_t *) data;
+	if(memcmp(h->magic, "DLVL", 4) || h->version != LEVELCACHE_VERSION ||
+	    h->hash != hash)
+		return false;
+
+	if(h->numvertexes < 0 || h->numvertexes > LEVELCACHE_MAXCOUNT ||
+	    h->numsectors < 0 || h->numsectors > LEVELCACHE_MAXCOUNT ||
+	    h->numsides < 0 || h->numsides > LEVELCACHE_MAXCOUNT ||
+	    h->numlines < 0 || h->numlines > LEVELCACHE_MAXCOUNT ||
+	    h->numsubsectors < 1 || h->numsubsectors > LEVELCACHE_MAXCOUNT ||
+	    h->numnodes < 0 || h->numnodes > LEVELCACHE_MAXCOUNT ||
+	    h->numsegs < 0 || h->numsegs > LEVELCACHE_MAXCOUNT ||
+	    h->numsectorlines < 0 || h->numsectorlines > LEVELCACHE_MAXCOUNT ||
+	    h->numblockmap < 4 || h->numblockmap > LEVELCACHE_MAXCOUNT)
+		return false;
+
+	if(h->size != size || P_CacheSize(h) != size) return false;
+
+	data += sizeof(levelheader_t) + h->numvertexes * sizeof(vertex_t);
+
+	sector = (cachesector_t *) data;
+	for(i = 0; i < h->numsectors; i++, sector++) {
+		if(BADINDEX(sector->floorpic, numflats, false) ||
+		    BADINDEX(sector->ceilingpic, numflats, false) ||
+		    sector->firstline < 0 || sector->linecount < 0 ||
+		    sector->firstline > h->numsectorlines - sector->linecount)
+			return false;
+	}
+
+	side = (cacheside_t *) sector;
+	for(i = 0; i < h->numsides; i++, side++) {
+		if(BADINDEX(side->toptexture, numtextures, false) ||
+		    BADINDEX(side->bottomtexture, numtextures, false) ||
+		    BADINDEX(side->midtexture, numtextures, false) ||
+		    BADINDEX(side->sector, h->numsectors, false))
+			return false;
+	}
+
+	line = (cacheline_t *) side;
+	for(i = 0; i < h->numlines; i++, line++) {
+		if(BADINDEX(line->v1, h->numvertexes, false) ||
+		    BADINDEX(line->v2, h->numvertexes, false) ||
+		    BADINDEX(line->sidenum[0], h->numsides, true) ||
+		    BADINDEX(line->sidenum[1], h->numsides, true) ||
+		    line->slopetype < ST_HORIZONTAL ||
+		    line->slopetype > ST_NEGATIVE ||
+		    BADINDEX(line->frontsector, h->numsectors, true) ||
+		    BADINDEX(line->backsector, h->numsectors, true))
+			return false;
+	}
+
+	sub = (cachesubsector_t *) line;
+	for(i = 0; i < h->numsubsectors; i++, sub++) {
+		if(BADINDEX(sub->sector, h->numsectors, false) ||
+		    BADINDEX(sub->firstline, h->numsegs, false) || sub->numlines < 0 ||
+		    sub->numlines > h->numsegs - sub->firstline)
+			return false;
+	}
+
+	// Node builders put the children before their parent, which
+	//  also keeps a broken file from sending the BSP walk in circles.
+	node = (node_t *) sub;
+	for(i = 0; i < h->numnodes; i++, node++) {
+		for(j = 0; j < 2; j++) {
+			child = node->children[j];
+			if(child & NF_SUBSECTOR) {
+				if((child & ~NF_SUBSECTOR) >= h->numsubsectors) return false;
+			}
+			else if(child >= i)
+				return false;
+		}
+	}
+
+	seg = (cacheseg_t *) node;
+	for(i = 0; i < h->numsegs; i++, seg++) {
+		if(BADINDEX(seg->v1, h->numvertexes, false) ||
+		    BADINDEX(seg->v2, h->numvertexes, false) ||
+		    BADINDEX(seg->sidedef, h->numsides, false) ||
+		    BADINDEX(seg->linedef, h->numlines, false) ||
+		    BADINDEX(seg->frontsector, h->numsectors, true) ||
+		    BADINDEX(seg->backsector, h->numsectors, true))
+			return false;
+	}
+
+	sectorlines = (int *) seg;
+	for(i = 0; i < h->numsectorlines; i++) {
+		if(BADINDEX(sectorlines[i], h->numlines, false)) return false;
+	}
+
+	// The blockmap: header, one offset per block,
+	//  then the line lists those point to, ended by -1.
+	bmap = (short *) (sectorlines + h->numsectorlines);
+	if(bmap[2] <= 0 || bmap[3] <= 0 ||
+	    bmap[2] * bmap[3] > h->numblockmap - 4)
+		return false;
+
+	for(i = 0; i < bmap[2] * bmap[3]; i++) {
+		ofs = bmap[4 + i];
+		if(ofs < 4 || ofs >= h->numblockmap) return false;
+
+		for(; bmap[ofs] != -1; ofs++) {
+			if(BADINDEX(bmap[ofs], h->numlines, false) ||
+			    ofs == h->numblockmap - 1)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+#define SECTOR(i) ((i) == -1 ? NULL : &sectors[i])
+
+//
+// P_LinkCache
+// Copies a checked cache file into the level structures.
+//
+static void P_LinkCache(byte *data) {
+	levelheader_t *h;
+	cachesector_t *cs;
+	cacheside_t *cd;
+	cacheline_t *cl;
+	cachesubsector_t *cu;
+	cacheseg_t *cg;
+	sector_t *sector;
+	side_t *side;
+	line_t *line;
+	subsector_t *sub;
+	seg_t *seg;
+	line_t **linebuffer;
+	int *sectorlines;
+	int i, count;
+
+	h = (levelheader_t *) data;
+	data += sizeof(levelheader_t);
+
+	numvertexes = h->numvertexes;
+	vertexes = Z_Malloc(numvertexes * sizeof(vertex_t), PU_LEVEL, 0);
+	memcpy(vertexes, data, numvertexes * sizeof(vertex_t));
+	data += numvertexes * sizeof(vertex_t);
+
+	numsectors = h->numsectors;
+	sectors = Z_Malloc(numsectors * sizeof(sector_t), PU_LEVEL, 0);
+	memset(sectors, 0, numsectors * sizeof(sector_t));
+
+	numsides = h->numsides;
+	sides = Z_Malloc(numsides * sizeof(side_t), PU_LEVEL, 0);
+	memset(sides, 0, numsides * sizeof(side_t));
+
+	numlines = h->numlines;
+	lines = Z_Malloc(numlines * sizeof(line_t), PU_LEVEL, 0);
+	memset(lines, 0, numlines * sizeof(line_t));
+
+	linebuffer =
+	    Z_Malloc(h->numsectorlines * sizeof(*linebuffer), PU_LEVEL, 0);
+
+	cs = (cachesector_t *) data;
+	sector = sectors;
+	for(i = 0; i < numsectors; i++, cs++, sector++) {
+		sector->floorheight = cs->floorheight;
+		sector->ceilingheight = cs->ceilingheight;
+		sector->floorpic = cs->floorpic;
+		sector->ceilingpic = cs->ceilingpic;
+		sector->lightlevel = cs->lightlevel;
+		sector->special = cs->special;
+		sector->tag = cs->tag;
+		memcpy(sector->blockbox, cs->blockbox, sizeof(sector->blockbox));
+		sector->soundorg.x = cs->soundx;
+		sector->soundorg.y = cs->soundy;
+		sector->linecount = cs->linecount;
+		sector->lines = linebuffer + cs->firstline;
+	}
+
+	cd = (cacheside_t *) cs;
+	side = sides;
+	for(i = 0; i < numsides; i++, cd++, side++) {
+		side->textureoffset = cd->textureoffset;
+		side->rowoffset = cd->rowoffset;
+		side->toptexture = cd->toptexture;
+		side->bottomtexture = cd->bottomtexture;
+		side->midtexture = cd->midtexture;
+		side->sector = &sectors[cd->sector];
+	}
+
+	cl = (cacheline_t *) cd;
+	line = lines;
+	for(i = 0; i < numlines; i++, cl++, line++) {
+		line->v1 = &vertexes[cl->v1];
+		line->v2 = &vertexes[cl->v2];
+		line->dx = cl->dx;
+		line->dy = cl->dy;
+		line->flags = cl->flags;
+		line->special = cl->special;
+		line->tag = cl->tag;
+		line->sidenum[0] = cl->sidenum[0];
+		line->sidenum[1] = cl->sidenum[1];
+		memcpy(line->bbox, cl->bbox, sizeof(line->bbox));
+		line->slopetype = cl->slopetype;
+		line->frontsector = SECTOR(cl->frontsector);
+		line->backsector = SECTOR(cl->backsector);
+	}
+
+	numsubsectors = h->numsubsectors;
+	subsectors = Z_Malloc(numsubsectors * sizeof(subsector_t), PU_LEVEL, 0);
+
+	cu = (cachesubsector_t *) cl;
+	sub = subsectors;
+	for(i = 0; i < numsubsectors; i++, cu++, sub++) {
+		sub->sector = &sectors[cu->sector];
+		sub->numlines = cu->numlines;
+		sub->firstline = cu->firstline;
+	}
+
+	numnodes = h->numnodes;
+	nodes = Z_Malloc(numnodes * sizeof(node_t), PU_LEVEL, 0);
+	memcpy(nodes, cu, numnodes * sizeof(node_t));
+
+	numsegs = h->numsegs;
+	segs = Z_Malloc(numsegs * sizeof(seg_t), PU_LEVEL, 0);
+
+	cg = (cacheseg_t *) ((byte *) cu + numnodes * sizeof(node_t));
+	seg = segs;
+	for(i = 0; i < numsegs; i++, cg++, seg++) {
+		seg->v1 = &vertexes[cg->v1];
+		seg->v2 = &vertexes[cg->v2];
+		seg->offset = cg->offset;
+		seg->angle = cg->angle;
+		seg->sidedef = &sides[cg->sidedef];
+		seg->linedef = &lines[cg->linedef];
+		seg->frontsector = SECTOR(cg->frontsector);
+		seg->backsector = SECTOR(cg->backsector);
+	}
+
+	sectorlines = (int *) cg;
+	for(i = 0; i < h->numsectorlines; i++)
+		linebuffer[i] = &lines[sectorlines[i]];
+
+	// Same as the end of P_LoadBlockMap
+	blockmaplump = Z_Malloc(h->numblockmap * sizeof(short), PU_LEVEL, 0);
+	memcpy(blockmaplump, sectorlines + h->numsectorlines,
+	    h->numblockmap * sizeof(short));
+	blockmap = blockmaplump + 4;
+
+	bmaporgx = blockmaplump[0] << FRACBITS;
+	bmaporgy = blockmaplump[1] << FRACBITS;
+	bmapwidth = blockmaplump[2];
+	bmapheight = blockmaplump[3];
+
+	count = sizeof(*blocklinks) * bmapwidth * bmapheight;
+	blocklinks = Z_Malloc(count, PU_LEVEL, 0);
+	memset(blocklinks, 0, count);
+}
+
+//
+// P_ReadLevelCache
+//
+boolean P_ReadLevelCache(int lumpnum) {
+	char name[1024];
+	uint64_t hash;
+	struct stat st;
+	byte *data;
+	boolean ok;
+	FILE *f;
+
+	if(!M_CheckParm("-levelcache")) return false;
+
+	hash = P_CacheName(lumpnum, name, sizeof(name));
+
+	f = fopen(name, "rb");
+	if(!f) return false;
+
+	if(fstat(fileno(f), &st) == -1 || st.st_size < sizeof(levelheader_t) ||
+	    st.st_size > INT32_MAX) {
+		fclose(f);
+		return false;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	fclose(f);
+	if(data == MAP_FAILED) return false;
+
+	ok = P_CheckCache(data, st.st_size, hash);
+	if(ok) P_LinkCache(data);
+	else printf("P_ReadLevelCache: ignoring broken %s\n", name);
+
+	munmap(data, st.st_size);
+	return ok;
+}
+
+//
+// P_CacheIndex
+// Index of p in base[count], -1 for NULL.
+//  Pointers anywhere else make the map uncachable.
+//
+static boolean cachebroken;
+
+static int P_CacheIndex(
+    void *p, void *base, int size, int count, boolean null) {
+	ptrdiff_t ofs;
+
+	if(!p && null) return -1;
+
+	ofs = (byte *) p - (byte *) base;
+	if(!p || ofs < 0 || ofs % size || ofs / size >= count) {
+		cachebroken = true;
+		return 0;
+	}
+
+	return ofs / size;
+}
+
+#define VERTEXINDEX(p) \
+	P_CacheIndex(p, vertexes, sizeof(vertex_t), numvertexes, false)
+#define SECTORINDEX(p, null) \
+	P_CacheIndex(p, sectors, sizeof(sector_t), numsectors, null)
+
+//
+// P_WriteLevelCache
+//
+void P_WriteLevelCache(int lumpnum) {
+	char name[1024];
+	char tempname[1040];
+	levelheader_t h;
+	cachesector_t *cs;
+	cacheside_t *cd;
+	cacheline_t *cl;
+	cachesubsector_t *cu;
+	cacheseg_t *cg;
+	int *sectorlines;
+	line_t **linebuffer;
+	byte *data, *p;
+	FILE *f;
+	int i, ok, handle;
+
+	if(!M_CheckParm("-levelcache")) return;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "DLVL", 4);
+	h.version = LEVELCACHE_VERSION;
+	h.hash = P_CacheName(lumpnum, name, sizeof(name));
+	h.numvertexes = numvertexes;
+	h.numsectors = numsectors;
+	h.numsides = numsides;
+	h.numlines = numlines;
+	h.numsubsectors = numsubsectors;
+	h.numnodes = numnodes;
+	h.numsegs = numsegs;
+	h.numblockmap = W_LumpLength(lumpnum + ML_BLOCKMAP) / 2;
+
+	for(i = 0; i < numsectors; i++) h.numsectorlines += sectors[i].linecount;
+	linebuffer = numsectors ? sectors[0].lines : NULL;
+
+	h.size = P_CacheSize(&h);
+	data = malloc(h.size);
+	if(!data) I_Error("P_WriteLevelCache: out of memory");
+
+	cachebroken = false;
+	p = data;
+	memcpy(p, &h, sizeof(h));
+	p += sizeof(h);
+
+	memcpy(p, vertexes, numvertexes * sizeof(vertex_t));
+	p += numvertexes * sizeof(vertex_t);
+
+	cs = (cachesector_t *) p;
+	for(i = 0; i < numsectors; i++, cs++) {
+		cs->floorheight = sectors[i].floorheight;
+		cs->ceilingheight = sectors[i].ceilingheight;
+		cs->floorpic = sectors[i].floorpic;
+		cs->ceilingpic = sectors[i].ceilingpic;
+		cs->lightlevel = sectors[i].lightlevel;
+		cs->special = sectors[i].special;
+		cs->tag = sectors[i].tag;
+		memcpy(cs->blockbox, sectors[i].blockbox, sizeof(cs->blockbox));
+		cs->soundx = sectors[i].soundorg.x;
+		cs->soundy = sectors[i].soundorg.y;
+		cs->firstline = sectors[i].lines - linebuffer;
+		cs->linecount = sectors[i].linecount;
+	}
+
+	cd = (cacheside_t *) cs;
+	for(i = 0; i < numsides; i++, cd++) {
+		cd->textureoffset = sides[i].textureoffset;
+		cd->rowoffset = sides[i].rowoffset;
+		cd->toptexture = sides[i].toptexture;
+		cd->bottomtexture = sides[i].bottomtexture;
+		cd->midtexture = sides[i].midtexture;
+		cd->sector = SECTORINDEX(sides[i].sector, false);
+	}
+
+	cl = (cacheline_t *) cd;
+	for(i = 0; i < numlines; i++, cl++) {
+		cl->v1 = VERTEXINDEX(lines[i].v1);
+		cl->v2 = VERTEXINDEX(lines[i].v2);
+		cl->dx = lines[i].dx;
+		cl->dy = lines[i].dy;
+		cl->flags = lines[i].flags;
+		cl->special = lines[i].special;
+		cl->tag = lines[i].tag;
+		cl->sidenum[0] = lines[i].sidenum[0];
+		cl->sidenum[1] = lines[i].sidenum[1];
+		memcpy(cl->bbox, lines[i].bbox, sizeof(cl->bbox));
+		cl->slopetype = lines[i].slopetype;
+		cl->frontsector = SECTORINDEX(lines[i].frontsector, true);
+		cl->backsector = SECTORINDEX(lines[i].backsector, true);
+	}
+
+	cu = (cachesubsector_t *) cl;
+	for(i = 0; i < numsubsectors; i++, cu++) {
+		cu->sector = SECTORINDEX(subsectors[i].sector, false);
+		cu->numlines = subsectors[i].numlines;
+		cu->firstline = subsectors[i].firstline;
+	}
+
+	memcpy(cu, nodes, numnodes * sizeof(node_t));
+
+	cg = (cacheseg_t *) ((byte *) cu + numnodes * sizeof(node_t));
+	for(i = 0; i < numsegs; i++, cg++) {
+		cg->v1 = VERTEXINDEX(segs[i].v1);
+		cg->v2 = VERTEXINDEX(segs[i].v2);
+		cg->offset = segs[i].offset;
+		cg->angle = segs[i].angle;
+		cg->sidedef = P_CacheIndex(
+		    segs[i].sidedef, sides, sizeof(side_t), numsides, false);
+		cg->linedef = P_CacheIndex(
+		    segs[i].linedef, lines, sizeof(line_t), numlines, false);
+		cg->frontsector = SECTORINDEX(segs[i].frontsector, true);
+		cg->backsector = SECTORINDEX(segs[i].backsector, true);
+	}
+
+	sectorlines = (int *) cg;
+	for(i = 0; i < h.numsectorlines; i++) {
+		sectorlines[i] = P_CacheIndex(
+		    linebuffer[i], lines, sizeof(line_t), numlines, false);
+	}
+
+	memcpy(sectorlines + h.numsectorlines, blockmaplump,
+	    h.numblockmap * sizeof(short));
+
+	// Maps that point outside of their own arrays (sides[-1]
+	//  for two sided lines without a back side and the like)
+	//  work by accident, they can't be written down.
+	//  The same goes for anything P_CheckCache would turn down.
+	if(cachebroken || !P_CheckCache(data, h.size, h.hash)) {
+		printf("P_WriteLevelCache: map can't be cached\n");
+		free(data);
+		return;
+	}
+
+	// Written under another name first,
+	//  so no one ever maps half a file.
+	snprintf(tempname, sizeof(tempname), "%s.XXXXXX", name);
+	handle = mkstemp(tempname);
+	f = handle == -1 ? NULL : fdopen(handle, "wb");
+	if(!f) {
+		printf("P_WriteLevelCache: couldn't write %s\n", tempname);
+		free(data);
+		return;
+	}
+
+	ok = fwrite(data, h.size, 1, f) == 1;
+	ok &= fclose(f) == 0;
+	if(!ok || rename(tempname, name)) {
+		printf("P_WriteLevelCache: couldn't write %s\n", name);
+		remove(tempname);
+	}
+
+	free(data);
+}
@@ -0,0 +1,39 @@
+//-----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 by Fabillotic
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+// DESCRIPTION:
+//	Cache of the parsed level geometry, -levelcache.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __P_CACHE__
+#define __P_CACHE__
+
+#include "doomtype.h"
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+// Sets up vertexes, sectors, sides, lines, subsectors, nodes,
+//  segs, the blockmap and the sector line lists of the map at
+//  lumpnum from its cache file. False if there is none that
+//  matches, or without -levelcache.
+boolean P_ReadLevelCache(int lumpnum);
+
+// Writes the cache file of the map that was just set up.
+void P_WriteLevelCache(int lumpnum);
+
+#endif
@@ -36,6 +36,8 @@
 
 ceiling_t *activeceilings[MAXCEILINGS];
 
+zonepool_t ceilingpool = {sizeof(ceiling_t), PU_LEVSPEC};
+
 //
 // T_MoveCeiling
 //
@@ -145,7 +147,7 @@ int EV_DoCeiling(line_t *line, ceiling_e type) {
 
 		// new door thinker
 		rtn = 1;
-		ceiling = Z_Malloc(sizeof(*ceiling), PU_LEVSPEC, 0);
+		ceiling = Z_PoolAlloc(&ceilingpool);
 		P_AddThinker(&ceiling->thinker);
 		sec->specialdata = ceiling;
 		ceiling->thinker.function.acp1 = (actionf_p1) T_MoveCeiling;
@@ -31,6 +31,8 @@
 #include "dstrings.h"
 #include "sounds.h"
 
+zonepool_t doorpool = {sizeof(vldoor_t), PU_LEVSPEC};
+
 #if 0
 //
 // Sliding door frame information
@@ -223,7 +225,7 @@ int EV_DoDoor(line_t *line, vldoor_e type) {
 
 		// new door thinker
 		rtn = 1;
-		door = Z_Malloc(sizeof(*door), PU_LEVSPEC, 0);
+		door = Z_PoolAlloc(&doorpool);
 		P_AddThinker(&door->thinker);
 		sec->specialdata = door;
 
@@ -368,7 +370,7 @@ void EV_VerticalDoor(line_t *line, mobj_t *thing) {
 	}
 
 	// new door thinker
-	door = Z_Malloc(sizeof(*door), PU_LEVSPEC, 0);
+	door = Z_PoolAlloc(&doorpool);
 	P_AddThinker(&door->thinker);
 	sec->specialdata = door;
 	door->thinker.function.acp1 = (actionf_p1) T_VerticalDoor;
@@ -413,7 +415,7 @@ void EV_VerticalDoor(line_t *line, mobj_t *thing) {
 void P_SpawnDoorCloseIn30(sector_t *sec) {
 	vldoor_t *door;
 
-	door = Z_Malloc(sizeof(*door), PU_LEVSPEC, 0);
+	door = Z_PoolAlloc(&doorpool);
 
 	P_AddThinker(&door->thinker);
 
@@ -434,7 +436,7 @@ void P_SpawnDoorCloseIn30(sector_t *sec) {
 void P_SpawnDoorRaiseIn5Mins(sector_t *sec, int secnum) {
 	vldoor_t *door;
 
-	door = Z_Malloc(sizeof(*door), PU_LEVSPEC, 0);
+	door = Z_PoolAlloc(&doorpool);
 
 	P_AddThinker(&door->thinker);
 
@@ -643,7 +645,7 @@ EV_SlidingDoor
     // Init sliding door vars
     if (!door)
     {
-	door = Z_Malloc (sizeof(*door), PU_LEVSPEC, 0);
+	door = Z_PoolAlloc (&doorpool);
 	P_AddThinker (&door->thinker);
 	sec->specialdata = door;
 		
@@ -30,6 +30,8 @@
 // Data.
 #include "sounds.h"
 
+zonepool_t floorpool = {sizeof(floormove_t), PU_LEVSPEC};
+
 //
 // FLOORS
 //
@@ -223,7 +225,7 @@ int EV_DoFloor(line_t *line, floor_e floortype) {
 
 		// new floor thinker
 		rtn = 1;
-		floor = Z_Malloc(sizeof(*floor), PU_LEVSPEC, 0);
+		floor = Z_PoolAlloc(&floorpool);
 		P_AddThinker(&floor->thinker);
 		sec->specialdata = floor;
 		floor->thinker.function.acp1 = (actionf_p1) T_MoveFloor;
@@ -392,7 +394,7 @@ int EV_BuildStairs(line_t *line, stair_e type) {
 
 		// new floor thinker
 		rtn = 1;
-		floor = Z_Malloc(sizeof(*floor), PU_LEVSPEC, 0);
+		floor = Z_PoolAlloc(&floorpool);
 		P_AddThinker(&floor->thinker);
 		sec->specialdata = floor;
 		floor->thinker.function.acp1 = (actionf_p1) T_MoveFloor;
@@ -438,7 +440,7 @@ int EV_BuildStairs(line_t *line, stair_e type) {
 
 				sec = tsec;
 				secnum = newsecnum;
-				floor = Z_Malloc(sizeof(*floor), PU_LEVSPEC, 0);
+				floor = Z_PoolAlloc(&floorpool);
 
 				P_AddThinker(&floor->thinker);
 
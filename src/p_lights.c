@@ -28,6 +28,11 @@
 // State.
 #include "r_state.h"
 
+zonepool_t flickerpool = {sizeof(fireflicker_t), PU_LEVSPEC};
+zonepool_t flashpool = {sizeof(lightflash_t), PU_LEVSPEC};
+zonepool_t strobepool = {sizeof(strobe_t), PU_LEVSPEC};
+zonepool_t glowpool = {sizeof(glow_t), PU_LEVSPEC};
+
 //
 // FIRELIGHT FLICKER
 //
@@ -59,7 +64,7 @@ void P_SpawnFireFlicker(sector_t *sector) {
 	// Nothing special about it during gameplay.
 	sector->special = 0;
 
-	flick = Z_Malloc(sizeof(*flick), PU_LEVSPEC, 0);
+	flick = Z_PoolAlloc(&flickerpool);
 
 	P_AddThinker(&flick->thinker);
 
@@ -103,7 +108,7 @@ void P_SpawnLightFlash(sector_t *sector) {
 	// nothing special about it during gameplay
 	sector->special = 0;
 
-	flash = Z_Malloc(sizeof(*flash), PU_LEVSPEC, 0);
+	flash = Z_PoolAlloc(&flashpool);
 
 	P_AddThinker(&flash->thinker);
 
@@ -145,7 +150,7 @@ void T_StrobeFlash(strobe_t *flash) {
 void P_SpawnStrobeFlash(sector_t *sector, int fastOrSlow, int inSync) {
 	strobe_t *flash;
 
-	flash = Z_Malloc(sizeof(*flash), PU_LEVSPEC, 0);
+	flash = Z_PoolAlloc(&strobepool);
 
 	P_AddThinker(&flash->thinker);
 
@@ -269,7 +274,7 @@ void T_Glow(glow_t *g) {
 void P_SpawnGlowingLight(sector_t *sector) {
 	glow_t *g;
 
-	g = Z_Malloc(sizeof(*g), PU_LEVSPEC, 0);
+	g = Z_PoolAlloc(&glowpool);
 
 	P_AddThinker(&g->thinker);
 
@@ -25,6 +25,8 @@
 #include "r_local.h"
 #endif
 
+#include "z_zone.h"
+
 #define FLOATSPEED (FRACUNIT * 4)
 
 #define MAXHEALTH 100
@@ -95,6 +97,8 @@ extern int iquetail;
 
 void P_RespawnSpecials(void);
 
+extern zonepool_t mobjpool;
+
 mobj_t *P_SpawnMobj(fixed_t x, fixed_t y, fixed_t z, mobjtype_t type);
 
 void P_RemoveMobj(mobj_t *th);
@@ -33,6 +33,8 @@
 
 #include "doomstat.h"
 
+zonepool_t mobjpool = {sizeof(mobj_t), PU_LEVEL};
+
 void G_PlayerReborn(int player);
 void P_SpawnMapThing(mapthing_t *mthing);
 
@@ -384,7 +386,7 @@ mobj_t *P_SpawnMobj(fixed_t x, fixed_t y, fixed_t z, mobjtype_t type) {
 	state_t *st;
 	mobjinfo_t *info;
 
-	mobj = Z_Malloc(sizeof(*mobj), PU_LEVEL, NULL);
+	mobj = Z_PoolAlloc(&mobjpool);
 	memset(mobj, 0, sizeof(*mobj));
 	info = &mobjinfo[type];
 
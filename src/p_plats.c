@@ -36,6 +36,8 @@
 
 plat_t *activeplats[MAXPLATS];
 
+zonepool_t platpool = {sizeof(plat_t), PU_LEVSPEC};
+
 //
 // Move a plat up and down
 //
@@ -124,7 +126,7 @@ int EV_DoPlat(line_t *line, plattype_e type, int amount) {
 
 		// Find lowest & highest floors around sector
 		rtn = 1;
-		plat = Z_Malloc(sizeof(*plat), PU_LEVSPEC, 0);
+		plat = Z_PoolAlloc(&platpool);
 		P_AddThinker(&plat->thinker);
 
 		plat->type = type;
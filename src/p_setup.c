@@ -32,7 +32,9 @@
 #include "w_wad.h"
 
 #include "doomdef.h"
+#include "p_cache.h"
 #include "p_local.h"
+#include "r_pvs.h"
 
 #include "s_sound.h"
 
@@ -267,6 +269,7 @@ void P_LoadThings(int lump) {
 	byte *data;
 	int i;
 	mapthing_t *mt;
+	mapthing_t thing;
 	int numthings;
 	boolean spawn;
 
@@ -297,13 +300,14 @@ void P_LoadThings(int lump) {
 		if(spawn == false) break;
 
 		// Do spawn all other stuff.
-		mt->x = SHORT(mt->x);
-		mt->y = SHORT(mt->y);
-		mt->angle = SHORT(mt->angle);
-		mt->type = SHORT(mt->type);
-		mt->options = SHORT(mt->options);
-
-		P_SpawnMapThing(mt);
+		// Swapped into a copy, the lump may be a read only mapping.
+		thing.x = SHORT(mt->x);
+		thing.y = SHORT(mt->y);
+		thing.angle = SHORT(mt->angle);
+		thing.type = SHORT(mt->type);
+		thing.options = SHORT(mt->options);
+
+		P_SpawnMapThing(&thing);
 	}
 
 	Z_Free(data);
@@ -407,10 +411,15 @@ void P_LoadSideDefs(int lump) {
 // P_LoadBlockMap
 //
 void P_LoadBlockMap(int lump) {
+	byte *data;
 	int i;
 	int count;
 
-	blockmaplump = W_CacheLumpNum(lump, PU_LEVEL);
+	// Swapped in place, so it needs a copy of its own.
+	blockmaplump = Z_Malloc(W_LumpLength(lump), PU_LEVEL, 0);
+	data = W_CacheLumpNum(lump, PU_STATIC);
+	memcpy(blockmaplump, data, W_LumpLength(lump));
+	Z_Free(data);
 	blockmap = blockmaplump + 4;
 	count = W_LumpLength(lump) / 2;
 
@@ -504,6 +513,54 @@ void P_GroupLines(void) {
 	}
 }
 
+//
+// P_SetupGeometry
+// Loads everything the renderer needs of the map at lumpnum.
+//
+void P_SetupGeometry(int lumpnum) {
+	P_LoadVertexes(lumpnum + ML_VERTEXES);
+	P_LoadSectors(lumpnum + ML_SECTORS);
+	P_LoadSideDefs(lumpnum + ML_SIDEDEFS);
+
+	P_LoadLineDefs(lumpnum + ML_LINEDEFS);
+	P_LoadSubsectors(lumpnum + ML_SSECTORS);
+	P_LoadNodes(lumpnum + ML_NODES);
+	P_LoadSegs(lumpnum + ML_SEGS);
+}
+
+//
+// P_MapLumpName
+//
+static void P_MapLumpName(int episode, int map, char *lumpname) {
+	if(gamemode == commercial) {
+		if(map < 10) sprintf(lumpname, "map0%i", map);
+		else sprintf(lumpname, "map%i", map);
+	}
+	else {
+		lumpname[0] = 'E';
+		lumpname[1] = '0' + episode;
+		lumpname[2] = 'M';
+		lumpname[3] = '0' + map;
+		lumpname[4] = 0;
+	}
+}
+
+//
+// P_PreloadLevel
+// Called when the intermission starts,
+//  the next level is read in the background.
+//
+void P_PreloadLevel(int episode, int map) {
+	char lumpname[9];
+	int lumpnum;
+
+	if(!precache) return;
+
+	P_MapLumpName(episode, map, lumpname);
+	lumpnum = W_CheckNumForName(lumpname);
+	if(lumpnum != -1) R_PreloadLevel(lumpnum);
+}
+
 //
 // P_SetupLevel
 //
@@ -526,6 +583,9 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill) {
 	// Make sure all sounds are stopped before Z_FreeTags.
 	S_Start();
 
+	// The precache threads write into PU_LEVEL blocks.
+	R_WaitPrecache();
+
 #if 0 // UNUSED
     if (debugfile)
     {
@@ -536,6 +596,9 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill) {
 #endif
 	Z_FreeTags(PU_LEVEL, PU_PURGELEVEL - 1);
 
+	// Give back what the last level needed on top
+	Z_ReleaseRegions();
+
 	// UNUSED W_Profile ();
 	P_InitThinkers();
 
@@ -543,35 +606,22 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill) {
 	W_Reload();
 
 	// find map name
-	if(gamemode == commercial) {
-		if(map < 10) sprintf(lumpname, "map0%i", map);
-		else sprintf(lumpname, "map%i", map);
-	}
-	else {
-		lumpname[0] = 'E';
-		lumpname[1] = '0' + episode;
-		lumpname[2] = 'M';
-		lumpname[3] = '0' + map;
-		lumpname[4] = 0;
-	}
-
+	P_MapLumpName(episode, map, lumpname);
 	lumpnum = W_GetNumForName(lumpname);
 
 	leveltime = 0;
 
 	// note: most of this ordering is important
-	P_LoadBlockMap(lumpnum + ML_BLOCKMAP);
-	P_LoadVertexes(lumpnum + ML_VERTEXES);
-	P_LoadSectors(lumpnum + ML_SECTORS);
-	P_LoadSideDefs(lumpnum + ML_SIDEDEFS);
-
-	P_LoadLineDefs(lumpnum + ML_LINEDEFS);
-	P_LoadSubsectors(lumpnum + ML_SSECTORS);
-	P_LoadNodes(lumpnum + ML_NODES);
-	P_LoadSegs(lumpnum + ML_SEGS);
+	if(!P_ReadLevelCache(lumpnum)) {
+		P_LoadBlockMap(lumpnum + ML_BLOCKMAP);
+		P_SetupGeometry(lumpnum);
+		P_GroupLines();
+		P_WriteLevelCache(lumpnum);
+	}
 
 	rejectmatrix = W_CacheLumpNum(lumpnum + ML_REJECT, PU_LEVEL);
-	P_GroupLines();
+
+	R_LoadPVS(lumpnum);
 
 	bodyqueslot = 0;
 	deathmatch_p = deathmatchstarts;
@@ -597,6 +647,9 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill) {
 
 	// preload graphics
 	if(precache) R_PrecacheLevel();
+	R_ReleasePreload();
+
+	if(devparm) Z_ReportFragmentation();
 
 	// printf ("free memory: 0x%x\n", Z_FreeMemory());
 }
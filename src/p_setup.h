@@ -28,6 +28,12 @@
 // NOT called by W_Ticker. Fixme.
 void P_SetupLevel(int episode, int map, int playermask, skill_t skill);
 
+// Starts reading the next level during the intermission.
+void P_PreloadLevel(int episode, int map);
+
+// Loads vertexes, sectors, sides, lines, subsectors, nodes and segs.
+void P_SetupGeometry(int lumpnum);
+
 // Called by startup code.
 void P_Init(void);
 
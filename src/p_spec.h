@@ -124,6 +124,11 @@ typedef struct {
 #define FASTDARK 15
 #define SLOWDARK 35
 
+extern zonepool_t flickerpool;
+extern zonepool_t flashpool;
+extern zonepool_t strobepool;
+extern zonepool_t glowpool;
+
 void P_SpawnFireFlicker(sector_t *sector);
 void T_LightFlash(lightflash_t *flash);
 void P_SpawnLightFlash(sector_t *sector);
@@ -222,6 +227,8 @@ typedef struct {
 
 extern plat_t *activeplats[MAXPLATS];
 
+extern zonepool_t platpool;
+
 void T_PlatRaise(plat_t *plat);
 
 int EV_DoPlat(line_t *line, plattype_e type, int amount);
@@ -267,6 +274,8 @@ typedef struct {
 #define VDOORSPEED FRACUNIT * 2
 #define VDOORWAIT 150
 
+extern zonepool_t doorpool;
+
 void EV_VerticalDoor(line_t *line, mobj_t *thing);
 
 int EV_DoDoor(line_t *line, vldoor_e type);
@@ -397,6 +406,8 @@ typedef struct {
 
 extern ceiling_t *activeceilings[MAXCEILINGS];
 
+extern zonepool_t ceilingpool;
+
 int EV_DoCeiling(line_t *line, ceiling_e type);
 
 void T_MoveCeiling(ceiling_t *ceiling);
@@ -475,6 +486,8 @@ result_e T_MovePlane(sector_t *sector, fixed_t speed, fixed_t dest,
 
 int EV_BuildStairs(line_t *line, stair_e type);
 
+extern zonepool_t floorpool;
+
 int EV_DoFloor(line_t *line, floor_e floortype);
 
 void T_MoveFloor(floormove_t *floor);
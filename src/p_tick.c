@@ -28,7 +28,7 @@ int leveltime;
 
 //
 // THINKERS
-// All thinkers should be allocated by Z_Malloc
+// All thinkers should be allocated by Z_PoolAlloc
 // so they can be operated on uniformly.
 // The actual structures will vary in size,
 // but the first element must be thinker_t.
@@ -77,19 +77,22 @@ void P_AllocateThinker(thinker_t *thinker) {
 //
 void P_RunThinkers(void) {
 	thinker_t *currentthinker;
+	thinker_t *next;
 
 	currentthinker = thinkercap.next;
 	while(currentthinker != &thinkercap) {
 		if(currentthinker->function.acv == (actionf_v) (-1)) {
 			// time to remove it
+			next = currentthinker->next;
 			currentthinker->next->prev = currentthinker->prev;
 			currentthinker->prev->next = currentthinker->next;
-			Z_Free(currentthinker);
-		}
-		else {
-			if(currentthinker->function.acp1)
-				currentthinker->function.acp1(currentthinker);
+			Z_PoolFree(currentthinker);
+			currentthinker = next;
+			continue;
 		}
+
+		if(currentthinker->function.acp1)
+			currentthinker->function.acp1(currentthinker);
 		currentthinker = currentthinker->next;
 	}
 }
@@ -18,6 +18,10 @@
 //
 //-----------------------------------------------------------------------------
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "doomdef.h"
 
 #include "m_bbox.h"
@@ -26,6 +30,7 @@
 
 #include "r_main.h"
 #include "r_plane.h"
+#include "r_pvs.h"
 #include "r_things.h"
 
 // State.
@@ -40,8 +45,11 @@ line_t *linedef;
 sector_t *frontsector;
 sector_t *backsector;
 
-drawseg_t drawsegs[MAXDRAWSEGS];
+// Grows by doubling, only ds_p points into it while
+//  the BSP is walked.
+drawseg_t *drawsegs;
 drawseg_t *ds_p;
+int maxdrawsegs;
 
 void R_StoreWallRange(int start, int stop);
 
@@ -52,6 +60,20 @@ void R_ClearDrawSegs(void) {
 	ds_p = drawsegs;
 }
 
+//
+// R_GrowDrawSegs
+// Called by R_StoreWallRange when all drawsegs are in use.
+//
+void R_GrowDrawSegs(void) {
+	int count;
+
+	count = ds_p - drawsegs;
+	maxdrawsegs = maxdrawsegs ? maxdrawsegs * 2 : 256;
+	drawsegs = realloc(drawsegs, maxdrawsegs * sizeof(drawseg_t));
+	if(!drawsegs) I_Error("R_GrowDrawSegs: no more drawsegs");
+	ds_p = drawsegs + count;
+}
+
 //
 // ClipWallSegment
 // Clips the given range of columns
@@ -63,12 +85,65 @@ typedef struct {
 
 } cliprange_t;
 
-#define MAXSEGS 32
+// Posts never touch, so there can't be more than one per
+//  two columns, plus the two sentinels.
+#define MAXSEGS (SCREENWIDTH / 2 + 2)
 
 // newend is one past the last valid seg
 cliprange_t *newend;
 cliprange_t solidsegs[MAXSEGS];
 
+// The same columns as solidsegs, one bit per screen column.
+//  Lets R_CheckBBox test a range a word at a time.
+#define SOLIDWORDS ((SCREENWIDTH + 31) / 32)
+
+static uint32_t solidcols[SOLIDWORDS];
+
+//
+// R_MarkSolidColumns
+// Sets the bits for columns first to last.
+//
+static void R_MarkSolidColumns(int first, int last) {
+	int w1, w2, w;
+	uint32_t m1, m2;
+
+	w1 = first >> 5;
+	w2 = last >> 5;
+	m1 = ~0u << (first & 31);
+	m2 = ~0u >> (31 - (last & 31));
+
+	if(w1 == w2) {
+		solidcols[w1] |= m1 & m2;
+		return;
+	}
+
+	solidcols[w1] |= m1;
+	for(w = w1 + 1; w < w2; w++) solidcols[w] = ~0u;
+	solidcols[w2] |= m2;
+}
+
+//
+// R_SolidColumns
+// Returns true if all of the columns first to last are solid.
+//
+static boolean R_SolidColumns(int first, int last) {
+	int w1, w2, w;
+	uint32_t m1, m2;
+
+	w1 = first >> 5;
+	w2 = last >> 5;
+	m1 = ~0u << (first & 31);
+	m2 = ~0u >> (31 - (last & 31));
+
+	if(w1 == w2) return (solidcols[w1] & m1 & m2) == (m1 & m2);
+
+	if((solidcols[w1] & m1) != m1) return false;
+	for(w = w1 + 1; w < w2; w++) {
+		if(solidcols[w] != ~0u) return false;
+	}
+	return (solidcols[w2] & m2) == m2;
+}
+
 //
 // R_ClipSolidWallSegment
 // Does handle solid walls,
@@ -79,6 +154,8 @@ void R_ClipSolidWallSegment(int first, int last) {
 	cliprange_t *next;
 	cliprange_t *start;
 
+	R_MarkSolidColumns(first, last);
+
 	// Find the first range that touches the range
 	//  (adjacent pixels are touching).
 	start = solidsegs;
@@ -195,6 +272,8 @@ void R_ClearClipSegs(void) {
 	solidsegs[1].first = viewwidth;
 	solidsegs[1].last = 0x7fffffff;
 	newend = solidsegs + 2;
+
+	memset(solidcols, 0, sizeof(solidcols));
 }
 
 //
@@ -316,8 +395,6 @@ boolean R_CheckBBox(fixed_t *bspcoord) {
 	angle_t span;
 	angle_t tspan;
 
-	cliprange_t *start;
-
 	int sx1;
 	int sx2;
 
@@ -368,9 +445,7 @@ boolean R_CheckBBox(fixed_t *bspcoord) {
 		angle2 = -clipangle;
 	}
 
-	// Find the first clippost
-	//  that touches the source post
-	//  (adjacent pixels are touching).
+	// Find the screen columns the box covers.
 	angle1 = (angle1 + ANG90) >> ANGLETOFINESHIFT;
 	angle2 = (angle2 + ANG90) >> ANGLETOFINESHIFT;
 	sx1 = viewangletox[angle1];
@@ -380,15 +455,9 @@ boolean R_CheckBBox(fixed_t *bspcoord) {
 	if(sx1 == sx2) return false;
 	sx2--;
 
-	start = solidsegs;
-	while(start->last < sx2) start++;
-
-	if(sx1 >= start->first && sx2 <= start->last) {
-		// The clippost contains the new span.
-		return false;
-	}
-
-	return true;
+	// Posts are merged as soon as they touch, so a single post
+	//  contains the span exactly when all of its columns are solid.
+	return !R_SolidColumns(sx1, sx2);
 }
 
 //
@@ -434,6 +503,33 @@ void R_Subsector(int num) {
 	}
 }
 
+//
+// R_HiddenBSPNode
+// Walks a subtree the PVS rules out the same way as
+//  R_RenderBSPNode. None of its walls can be seen, but
+//  the sprites of its things can still stick out of it.
+//
+static void R_HiddenBSPNode(int bspnum) {
+	node_t *bsp;
+	int side;
+
+	if(solidsegs[0].last >= viewwidth - 1) return;
+
+	if(bspnum & NF_SUBSECTOR) {
+		if(bspnum == -1) R_AddSprites(subsectors[0].sector);
+		else R_AddSprites(subsectors[bspnum & ~NF_SUBSECTOR].sector);
+		return;
+	}
+
+	bsp = &nodes[bspnum];
+	side = R_PointOnSide(viewx, viewy, bsp);
+
+	R_HiddenBSPNode(bsp->children[side]);
+
+	if(R_CheckBBox(bsp->bbox[side ^ 1]))
+		R_HiddenBSPNode(bsp->children[side ^ 1]);
+}
+
 //
 // RenderBSPNode
 // Renders all subsectors below a given node,
@@ -442,6 +538,26 @@ void R_Subsector(int num) {
 void R_RenderBSPNode(int bspnum) {
 	node_t *bsp;
 	int side;
+	int num;
+
+	// Every column is solid once the first post reaches the right
+	//  edge. Nothing behind that can show up anymore.
+	if(solidsegs[0].last >= viewwidth - 1) return;
+
+	// Can't be seen from the view subsector at all?
+	if(pvsnodes) {
+		if(bspnum & NF_SUBSECTOR) {
+			num = bspnum & ~NF_SUBSECTOR;
+			if(!((pvsrow[num >> 3] >> (num & 7)) & 1)) {
+				R_HiddenBSPNode(bspnum);
+				return;
+			}
+		}
+		else if(!pvsnodes[bspnum]) {
+			R_HiddenBSPNode(bspnum);
+			return;
+		}
+	}
 
 	// Found a subsector?
 	if(bspnum & NF_SUBSECTOR) {
@@ -19,7 +19,10 @@
 //
 //-----------------------------------------------------------------------------
 
+#include <pthread.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <sys/sysinfo.h>
 
 #include "i_system.h"
 #include "z_zone.h"
@@ -28,12 +31,15 @@
 
 #include "w_wad.h"
 
+#include "m_argv.h"
+
 #include "doomdef.h"
 #include "p_local.h"
 #include "r_local.h"
 
 #include "doomstat.h"
 #include "r_sky.h"
+#include "r_thread.h"
 
 #ifdef LINUX
 #include <alloca.h>
@@ -123,6 +129,11 @@ int numspritelumps;
 int numtextures;
 texture_t **textures;
 
+// Open addressed index of the texture names,
+//  every slot holds the first texture with that name.
+static int *texturehash;
+static int texturehashsize;
+
 int *texturewidthmask;
 // needed for texture pegging
 fixed_t *textureheight;
@@ -142,6 +153,233 @@ fixed_t *spritetopoffset;
 
 lighttable_t *colormaps;
 
+//
+// COMPOSITE CACHE
+// Composites live in an arena of their own with a fixed budget,
+//  -texcache <KB>, instead of PU_CACHE zone blocks that anything
+//  else can throw out. Each composite is one block of columns.
+//  When the arena is full the least recently used composites go
+//  and the rest is moved down to close the gaps.
+//
+#define TEXCACHE_DEFAULT (4096 * 1024)
+
+// Largest composite R_GenerateLookup allows
+#define TEXCACHE_MIN 0x10000
+
+texcachestats_t texcachestats;
+
+static byte *texcache;
+static int texcacheend;
+
+// LRU list of the composites in the arena,
+//  numtextures is the head, head's next the most recent.
+static int *texturelrunext;
+static int *texturelruprev;
+
+// Set once a composite was built, to tell rebuilds apart
+static byte *texturebuilt;
+
+//
+// LEVEL PRECACHE
+// R_PrecacheLevel pins the flats, patches and sprites of the level
+//  in PU_LEVEL blocks and has a few threads read them. The same
+//  threads then build the composites that fit into the arena.
+//  The level starts right away, whoever asks for something that
+//  is still on its way waits for it.
+// R_PreloadLevel uses the same threads during the intermission,
+//  it reads the map lumps of the next level and the flats and
+//  patches it needs into PU_PRELOAD blocks. P_SetupLevel and
+//  R_PrecacheLevel find them in the lump cache.
+//
+#define MAXPRECACHETHREADS 8
+
+typedef struct {
+	int lump; // -1 for a composite
+	int texnum;
+	byte *dest;
+} precachejob_t;
+
+static precachejob_t *precachejobs;
+static int numprecachejobs;
+static int maxprecachejobs;
+static int nextprecachejob;
+static int doneprecachejobs;
+
+// Nonzero while a lump / composite is being loaded
+static byte *lumppending;
+static byte *texturepending;
+
+static char *precachename;
+static int precachelumps;
+static int precachecomposites;
+static int precachebytes;
+static unsigned precachestart;
+
+// Map being preloaded until its textures are queued, or -1
+static int preloadmap = -1;
+static int preloadbudget;
+
+// True while the last batch of jobs is R_PreloadLevel's
+static boolean preloading;
+
+// Lumps read ahead, R_ReleasePreload makes the
+//  ones the level didn't claim purgable again.
+static int *preloadlumps;
+static int numpreloadlumps;
+static int maxpreloadlumps;
+
+static int numprecachethreads;
+static pthread_t precachethreads[MAXPRECACHETHREADS];
+static pthread_mutex_t precache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t precache_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t precache_done = PTHREAD_COND_INITIALIZER;
+
+static void R_WaitLump(int lump) {
+	if(!__atomic_load_n(&lumppending[lump], __ATOMIC_ACQUIRE)) return;
+
+	pthread_mutex_lock(&precache_mutex);
+	while(lumppending[lump]) pthread_cond_wait(&precache_done, &precache_mutex);
+	pthread_mutex_unlock(&precache_mutex);
+}
+
+static void R_WaitComposite(int texnum) {
+	if(!__atomic_load_n(&texturepending[texnum], __ATOMIC_ACQUIRE)) return;
+
+	pthread_mutex_lock(&precache_mutex);
+	while(texturepending[texnum])
+		pthread_cond_wait(&precache_done, &precache_mutex);
+	pthread_mutex_unlock(&precache_mutex);
+}
+
+//
+// R_WaitPrecache
+// Waits until everything R_PrecacheLevel started is loaded.
+//
+void R_WaitPrecache(void) {
+	pthread_mutex_lock(&precache_mutex);
+	while(doneprecachejobs < numprecachejobs)
+		pthread_cond_wait(&precache_done, &precache_mutex);
+	pthread_mutex_unlock(&precache_mutex);
+}
+
+static void R_UnlinkComposite(int texnum) {
+	texturelrunext[texturelruprev[texnum]] = texturelrunext[texnum];
+	texturelruprev[texturelrunext[texnum]] = texturelruprev[texnum];
+}
+
+static void R_LinkComposite(int texnum) {
+	texturelruprev[texnum] = numtextures;
+	texturelrunext[texnum] = texturelrunext[numtextures];
+	texturelruprev[texturelrunext[numtextures]] = texnum;
+	texturelrunext[numtextures] = texnum;
+}
+
+static int R_CompareComposites(const void *a, const void *b) {
+	byte *ca, *cb;
+
+	ca = texturecomposite[*(int *) a];
+	cb = texturecomposite[*(int *) b];
+	return ca < cb ? -1 : ca > cb;
+}
+
+//
+// R_CompactTexCache
+// Moves all composites to the start of the arena.
+//
+static void R_CompactTexCache(void) {
+	int *live;
+	int count, i, t;
+	byte *dest;
+
+	live = malloc(numtextures * sizeof(int));
+	if(!live) I_Error("R_CompactTexCache: out of memory");
+
+	count = 0;
+	for(t = texturelrunext[numtextures]; t != numtextures;
+	    t = texturelrunext[t])
+		live[count++] = t;
+	qsort(live, count, sizeof(int), R_CompareComposites);
+
+	dest = texcache;
+	for(i = 0; i < count; i++) {
+		t = live[i];
+		memmove(dest, texturecomposite[t], texturecompositesize[t]);
+		texturecomposite[t] = dest;
+		dest += texturecompositesize[t];
+	}
+	texcacheend = dest - texcache;
+
+	free(live);
+}
+
+//
+// R_AllocComposite
+// Finds room for the composite of texnum in the arena.
+//
+static byte *R_AllocComposite(int texnum) {
+	int size, t;
+
+	size = texturecompositesize[texnum];
+
+	if(texcacheend + size > texcachestats.budget) {
+		// Queued columns might still point into the arena,
+		//  precache threads might still be writing to it.
+		R_FlushDraws();
+		R_WaitPrecache();
+
+		while(texcachestats.used + size > texcachestats.budget &&
+		      texturelruprev[numtextures] != numtextures) {
+			t = texturelruprev[numtextures];
+			R_UnlinkComposite(t);
+			texturecomposite[t] = NULL;
+			texcachestats.used -= texturecompositesize[t];
+			texcachestats.evictions++;
+		}
+
+		R_CompactTexCache();
+	}
+
+	texturecomposite[texnum] = texcache + texcacheend;
+	texcacheend += size;
+	texcachestats.used += size;
+	R_LinkComposite(texnum);
+
+	return texturecomposite[texnum];
+}
+
+//
+// R_InitTexCache
+//
+static void R_InitTexCache(void) {
+	int p, i;
+
+	texcachestats.budget = TEXCACHE_DEFAULT;
+	p = M_CheckParm("-texcache");
+	if(p && p < myargc - 1) texcachestats.budget = atoi(myargv[p + 1]) * 1024;
+	if(texcachestats.budget < TEXCACHE_MIN)
+		texcachestats.budget = TEXCACHE_MIN;
+
+	// Every composite has to fit on its own
+	for(i = 0; i < numtextures; i++) {
+		if(texturecompositesize[i] > texcachestats.budget)
+			texcachestats.budget = texturecompositesize[i];
+	}
+
+	texcache = malloc(texcachestats.budget);
+	if(!texcache) I_Error("R_InitTexCache: couldn't allocate %i bytes",
+	    texcachestats.budget);
+
+	texturelrunext = Z_Malloc((numtextures + 1) * sizeof(int), PU_STATIC, 0);
+	texturelruprev = Z_Malloc((numtextures + 1) * sizeof(int), PU_STATIC, 0);
+	texturelrunext[numtextures] = texturelruprev[numtextures] = numtextures;
+
+	texturebuilt = Z_Malloc(numtextures, PU_STATIC, 0);
+	memset(texturebuilt, 0, numtextures);
+
+	texturepending = Z_Malloc(numtextures, PU_STATIC, 0);
+	memset(texturepending, 0, numtextures);
+}
+
 //
 // MAPTEXTURE_T CACHING
 // When a texture is first needed,
@@ -187,13 +425,11 @@ void R_DrawColumnInCache(
 }
 
 //
-// R_GenerateComposite
-// Using the texture definition,
-//  the composite texture is created from the patches,
-//  and each column is cached.
+// R_ComposeTexture
+// Draws the patches of texnum into block. Precache threads
+//  take the pinned patches straight from the lump cache.
 //
-void R_GenerateComposite(int texnum) {
-	byte *block;
+static void R_ComposeTexture(int texnum, byte *block, boolean pinned) {
 	texture_t *texture;
 	texpatch_t *patch;
 	patch_t *realpatch;
@@ -206,10 +442,6 @@ void R_GenerateComposite(int texnum) {
 	unsigned short *colofs;
 
 	texture = textures[texnum];
-
-	block = Z_Malloc(
-	    texturecompositesize[texnum], PU_STATIC, &texturecomposite[texnum]);
-
 	collump = texturecolumnlump[texnum];
 	colofs = texturecolumnofs[texnum];
 
@@ -218,7 +450,12 @@ void R_GenerateComposite(int texnum) {
 
 	for(i = 0, patch = texture->patches; i < texture->patchcount;
 	    i++, patch++) {
-		realpatch = W_CacheLumpNum(patch->patch, PU_CACHE);
+		if(pinned) {
+			R_WaitLump(patch->patch);
+			realpatch = lumpinfo[patch->patch].data;
+			if(!realpatch) realpatch = lumpcache[patch->patch];
+		}
+		else realpatch = W_CacheLumpNum(patch->patch, PU_CACHE);
 		x1 = patch->originx;
 		x2 = x1 + SHORT(realpatch->width);
 
@@ -237,10 +474,29 @@ void R_GenerateComposite(int texnum) {
 			    patchcol, block + colofs[x], patch->originy, texture->height);
 		}
 	}
+}
+
+//
+// R_CountComposite
+//
+static void R_CountComposite(int texnum) {
+	if(texturebuilt[texnum]) texcachestats.rebuilds++;
+	else texcachestats.misses++;
+	texturebuilt[texnum] = 1;
+}
+
+//
+// R_GenerateComposite
+// Using the texture definition,
+//  the composite texture is created from the patches,
+//  and each column is cached.
+//
+void R_GenerateComposite(int texnum) {
+	byte *block;
 
-	// Now that the texture has been built in column cache,
-	//  it is purgable from zone memory.
-	Z_ChangeTag(block, PU_CACHE);
+	R_CountComposite(texnum);
+	block = R_AllocComposite(texnum);
+	R_ComposeTexture(texnum, block, false);
 }
 
 //
@@ -328,10 +584,44 @@ byte *R_GetColumn(int tex, int col) {
 	if(lump > 0) return (byte *) W_CacheLumpNum(lump, PU_CACHE) + ofs;
 
 	if(!texturecomposite[tex]) R_GenerateComposite(tex);
+	else {
+		R_WaitComposite(tex);
+		texcachestats.hits++;
+		if(texturelrunext[numtextures] != tex) {
+			R_UnlinkComposite(tex);
+			R_LinkComposite(tex);
+		}
+	}
 
 	return texturecomposite[tex] + ofs;
 }
 
+//
+// R_HashTextures
+//
+static void R_HashTextures(void) {
+	unsigned slot;
+	int i, other;
+
+	texturehashsize = 1024;
+	while(numtextures * 2 > texturehashsize) texturehashsize *= 2;
+
+	texturehash = Z_Malloc(texturehashsize * sizeof(int), PU_STATIC, 0);
+	memset(texturehash, -1, texturehashsize * sizeof(int));
+
+	for(i = 0; i < numtextures; i++) {
+		slot = W_HashName(textures[i]->name) & (texturehashsize - 1);
+
+		while((other = texturehash[slot]) != -1) {
+			if(!strncasecmp(textures[other]->name, textures[i]->name, 8))
+				break;
+			slot = (slot + 1) & (texturehashsize - 1);
+		}
+
+		if(other == -1) texturehash[slot] = i;
+	}
+}
+
 //
 // R_InitTextures
 // Initializes the texture list
@@ -479,9 +769,13 @@ void R_InitTextures(void) {
 	Z_Free(maptex1);
 	if(maptex2) Z_Free(maptex2);
 
+	R_HashTextures();
+
 	// Precalculate whatever possible.
 	for(i = 0; i < numtextures; i++) R_GenerateLookup(i);
 
+	R_InitTexCache();
+
 	// Create translation table for global animation.
 	texturetranslation = Z_Malloc((numtextures + 1) * 4, PU_STATIC, 0);
 
@@ -564,6 +858,26 @@ void R_InitData(void) {
 	printf("\nInitColormaps");
 }
 
+//
+// R_CheckFlatNumForName
+// Flat number for a flat name, -1 if there is none.
+//  Only lumps between F_START and F_END count, a lump
+//  with the same name elsewhere is not a flat.
+//
+int R_CheckFlatNumForName(char *name) {
+	int i;
+
+	// Usually the last lump with the name is the flat
+	i = W_CheckNumForName(name);
+	if(i >= firstflat && i <= lastflat) return i - firstflat;
+
+	for(i = lastflat; i >= firstflat; i--) {
+		if(!strncasecmp(lumpinfo[i].name, name, 8)) return i - firstflat;
+	}
+
+	return -1;
+}
+
 //
 // R_FlatNumForName
 // Retrieval, get a flat number for a flat name.
@@ -572,14 +886,14 @@ int R_FlatNumForName(char *name) {
 	int i;
 	char namet[9];
 
-	i = W_CheckNumForName(name);
+	i = R_CheckFlatNumForName(name);
 
 	if(i == -1) {
 		namet[8] = 0;
 		memcpy(namet, name, 8);
 		I_Error("R_FlatNumForName: %s not found", namet);
 	}
-	return i - firstflat;
+	return i;
 }
 
 //
@@ -588,13 +902,18 @@ int R_FlatNumForName(char *name) {
 // Filter out NoTexture indicator.
 //
 int R_CheckTextureNumForName(char *name) {
+	unsigned slot;
 	int i;
 
 	// "NoTexture" marker.
 	if(name[0] == '-') return 0;
 
-	for(i = 0; i < numtextures; i++)
+	slot = W_HashName(name) & (texturehashsize - 1);
+
+	while((i = texturehash[slot]) != -1) {
 		if(!strncasecmp(textures[i]->name, name, 8)) return i;
+		slot = (slot + 1) & (texturehashsize - 1);
+	}
 
 	return -1;
 }
@@ -615,6 +934,283 @@ int R_TextureNumForName(char *name) {
 	return i;
 }
 
+//
+// R_PrecacheWorker
+//
+static void *R_PrecacheWorker(void *arg) {
+	precachejob_t job;
+
+	(void) arg;
+
+	pthread_mutex_lock(&precache_mutex);
+	for(;;) {
+		while(nextprecachejob == numprecachejobs)
+			pthread_cond_wait(&precache_cond, &precache_mutex);
+		job = precachejobs[nextprecachejob++];
+		pthread_mutex_unlock(&precache_mutex);
+
+		if(job.lump >= 0) W_ReadLump(job.lump, job.dest);
+		else R_ComposeTexture(job.texnum, job.dest, true);
+
+		pthread_mutex_lock(&precache_mutex);
+		if(job.lump >= 0)
+			__atomic_store_n(&lumppending[job.lump], 0, __ATOMIC_RELEASE);
+		else __atomic_store_n(&texturepending[job.texnum], 0, __ATOMIC_RELEASE);
+
+		if(++doneprecachejobs == numprecachejobs) {
+			printf("%s: %i lumps, %i composites, %i bytes in %u ms\n",
+			    precachename, precachelumps, precachecomposites, precachebytes,
+			    (I_GetTimeUS() - precachestart) / 1000);
+		}
+		pthread_cond_broadcast(&precache_done);
+	}
+
+	return NULL;
+}
+
+static void R_AddPrecacheJob(int lump, int texnum, byte *dest, int size) {
+	precachejob_t *job;
+
+	pthread_mutex_lock(&precache_mutex);
+	if(numprecachejobs == maxprecachejobs) {
+		maxprecachejobs = maxprecachejobs ? maxprecachejobs * 2 : 1024;
+		precachejobs =
+		    realloc(precachejobs, maxprecachejobs * sizeof(precachejob_t));
+		if(!precachejobs) I_Error("R_PrecacheLevel: out of memory");
+	}
+
+	job = &precachejobs[numprecachejobs++];
+	job->lump = lump;
+	job->texnum = texnum;
+	job->dest = dest;
+
+	if(lump >= 0) precachelumps++;
+	else precachecomposites++;
+	precachebytes += size;
+
+	pthread_cond_signal(&precache_cond);
+	pthread_mutex_unlock(&precache_mutex);
+}
+
+static int R_LumpTag(int lump) {
+	return ((memblock_t *) ((byte *) lumpcache[lump] - sizeof(memblock_t)))
+	    ->tag;
+}
+
+//
+// R_PinLump
+// Keeps lump in memory with tag (PU_LEVEL or PU_PRELOAD),
+//  loading it on a precache thread if needed.
+//
+static void R_PinLump(int lump, int tag, int *budget) {
+	int size, oldtag;
+
+	// Mapped lumps never leave memory
+	if(lumpinfo[lump].data) return;
+
+	if(lumpcache[lump]) {
+		// Only ever move between purgable, this level and the next
+		oldtag = R_LumpTag(lump);
+		if(oldtag != tag && (oldtag >= PU_PURGELEVEL || oldtag == PU_LEVEL ||
+		                        oldtag == PU_PRELOAD))
+			Z_ChangeTag(lumpcache[lump], tag);
+	}
+	else {
+		size = W_LumpLength(lump);
+		if(size > *budget) return;
+		*budget -= size;
+
+		Z_Malloc(size, tag, &lumpcache[lump]);
+		lumppending[lump] = 1;
+		R_AddPrecacheJob(lump, -1, lumpcache[lump], size);
+	}
+
+	if(tag != PU_PRELOAD) return;
+
+	if(numpreloadlumps == maxpreloadlumps) {
+		maxpreloadlumps = maxpreloadlumps ? maxpreloadlumps * 2 : 256;
+		preloadlumps =
+		    realloc(preloadlumps, maxpreloadlumps * sizeof(*preloadlumps));
+		if(!preloadlumps) I_Error("R_PreloadLevel: out of memory");
+	}
+	preloadlumps[numpreloadlumps++] = lump;
+}
+
+//
+// R_StartPrecache
+// Starts the threads the first time, then waits
+//  for the last batch of jobs and starts a new one.
+//
+static void R_StartPrecache(char *name) {
+	int i;
+
+	if(!numprecachethreads) {
+		lumppending = Z_Malloc(numlumps, PU_STATIC, 0);
+		memset(lumppending, 0, numlumps);
+
+		numprecachethreads = get_nprocs();
+		if(numprecachethreads < 1) numprecachethreads = 1;
+		if(numprecachethreads > MAXPRECACHETHREADS)
+			numprecachethreads = MAXPRECACHETHREADS;
+
+		for(i = 0; i < numprecachethreads; i++) {
+			if(pthread_create(
+			       &precachethreads[i], NULL, R_PrecacheWorker, NULL))
+				I_Error("%s: couldn't start thread", name);
+		}
+
+		lumpwaitfunc = R_WaitLump;
+	}
+
+	R_WaitPrecache();
+	preloading = false;
+
+	pthread_mutex_lock(&precache_mutex);
+	numprecachejobs = nextprecachejob = doneprecachejobs = 0;
+	precachelumps = precachecomposites = precachebytes = 0;
+	precachestart = I_GetTimeUS();
+	precachename = name;
+	pthread_mutex_unlock(&precache_mutex);
+}
+
+//
+// R_PreloadLevel
+// Starts reading the map at lumpnum, R_PreloadTicker
+//  queues its flats and patches once the map is in.
+//
+void R_PreloadLevel(int lumpnum) {
+	int i;
+
+	R_StartPrecache("R_PreloadLevel");
+	preloading = true;
+
+	// The current level is still in memory
+	preloadbudget = Z_FreeMemory() / 4;
+	preloadmap = lumpnum;
+
+	for(i = ML_THINGS; i <= ML_BLOCKMAP; i++)
+		R_PinLump(lumpnum + i, PU_PRELOAD, &preloadbudget);
+}
+
+//
+// R_PreloadedLump
+// Data of a lump that was preloaded, NULL while it's on its way.
+//
+static void *R_PreloadedLump(int lump) {
+	if(lumpinfo[lump].data) return lumpinfo[lump].data;
+	if(__atomic_load_n(&lumppending[lump], __ATOMIC_ACQUIRE)) return NULL;
+	return lumpcache[lump];
+}
+
+//
+// R_PreloadTicker
+//
+void R_PreloadTicker(void) {
+	mapsidedef_t *msd;
+	mapsector_t *ms;
+	texture_t *texture;
+	char *texturepresent;
+	int i, j, count;
+	int sidelump, sectorlump;
+
+	if(preloadmap == -1) return;
+
+	sidelump = preloadmap + ML_SIDEDEFS;
+	sectorlump = preloadmap + ML_SECTORS;
+
+	// Didn't fit
+	if((!lumpinfo[sidelump].data && !lumpcache[sidelump]) ||
+	    (!lumpinfo[sectorlump].data && !lumpcache[sectorlump])) {
+		preloadmap = -1;
+		return;
+	}
+
+	msd = R_PreloadedLump(sidelump);
+	ms = R_PreloadedLump(sectorlump);
+	if(!msd || !ms) return;
+
+	preloadmap = -1;
+
+	count = W_LumpLength(sectorlump) / sizeof(mapsector_t);
+	for(i = 0; i < count; i++, ms++) {
+		j = R_CheckFlatNumForName(ms->floorpic);
+		if(j != -1) R_PinLump(firstflat + j, PU_PRELOAD, &preloadbudget);
+
+		j = R_CheckFlatNumForName(ms->ceilingpic);
+		if(j != -1) R_PinLump(firstflat + j, PU_PRELOAD, &preloadbudget);
+	}
+
+	texturepresent = alloca(numtextures);
+	memset(texturepresent, 0, numtextures);
+
+	count = W_LumpLength(sidelump) / sizeof(mapsidedef_t);
+	for(i = 0; i < count; i++, msd++) {
+		j = R_CheckTextureNumForName(msd->toptexture);
+		if(j > 0) texturepresent[j] = 1;
+		j = R_CheckTextureNumForName(msd->midtexture);
+		if(j > 0) texturepresent[j] = 1;
+		j = R_CheckTextureNumForName(msd->bottomtexture);
+		if(j > 0) texturepresent[j] = 1;
+	}
+
+	for(i = 0; i < numtextures; i++) {
+		if(!texturepresent[i]) continue;
+
+		texture = textures[i];
+		for(j = 0; j < texture->patchcount; j++)
+			R_PinLump(texture->patches[j].patch, PU_PRELOAD, &preloadbudget);
+	}
+}
+
+//
+// R_ReleasePreload
+//
+void R_ReleasePreload(void) {
+	int i, lump;
+
+	// Still reading ahead when the next level never comes
+	if(preloading) R_WaitPrecache();
+
+	// No need to wait for R_PrecacheLevel: the preload jobs are
+	//  done (P_SetupLevel and R_StartPrecache waited for them),
+	//  and the patches of queued composites were pinned PU_LEVEL.
+	for(i = 0; i < numpreloadlumps; i++) {
+		lump = preloadlumps[i];
+		if(lumpcache[lump] && R_LumpTag(lump) == PU_PRELOAD)
+			Z_ChangeTag(lumpcache[lump], PU_CACHE);
+	}
+
+	numpreloadlumps = 0;
+	preloadmap = -1;
+}
+
+//
+// R_PinComposite
+// Builds the composite of texnum on a precache thread,
+//  as long as it fits and all its patches are pinned.
+//
+static void R_PinComposite(int texnum) {
+	texture_t *texture;
+	byte *block;
+	int i, lump;
+
+	if(!texturecompositesize[texnum] || texturecomposite[texnum]) return;
+	if(texcacheend + texturecompositesize[texnum] > texcachestats.budget)
+		return;
+
+	texture = textures[texnum];
+	for(i = 0; i < texture->patchcount; i++) {
+		lump = texture->patches[i].patch;
+		if(lumpinfo[lump].data) continue;
+		if(!lumpcache[lump] || R_LumpTag(lump) >= PU_PURGELEVEL) return;
+	}
+
+	R_CountComposite(texnum);
+	block = R_AllocComposite(texnum);
+	texturepending[texnum] = 1;
+	R_AddPrecacheJob(-1, texnum, block, texturecompositesize[texnum]);
+}
+
 //
 // R_PrecacheLevel
 // Preloads all relevant graphics for the level.
@@ -632,12 +1228,16 @@ void R_PrecacheLevel(void) {
 	int j;
 	int k;
 	int lump;
+	int budget;
 
 	texture_t *texture;
 	thinker_t *th;
 	spriteframe_t *sf;
 
-	if(demoplayback) return;
+	R_StartPrecache("R_PrecacheLevel");
+
+	// Leave half of the zone to everything else
+	budget = Z_FreeMemory() / 2;
 
 	// Precache flats.
 	flatpresent = alloca(numflats);
@@ -654,7 +1254,7 @@ void R_PrecacheLevel(void) {
 		if(flatpresent[i]) {
 			lump = firstflat + i;
 			flatmemory += lumpinfo[lump].size;
-			W_CacheLumpNum(lump, PU_CACHE);
+			R_PinLump(lump, PU_LEVEL, &budget);
 		}
 	}
 
@@ -685,7 +1285,7 @@ void R_PrecacheLevel(void) {
 		for(j = 0; j < texture->patchcount; j++) {
 			lump = texture->patches[j].patch;
 			texturememory += lumpinfo[lump].size;
-			W_CacheLumpNum(lump, PU_CACHE);
+			R_PinLump(lump, PU_LEVEL, &budget);
 		}
 	}
 
@@ -707,8 +1307,21 @@ void R_PrecacheLevel(void) {
 			for(k = 0; k < 8; k++) {
 				lump = firstspritelump + sf->lump[k];
 				spritememory += lumpinfo[lump].size;
-				W_CacheLumpNum(lump, PU_CACHE);
+				R_PinLump(lump, PU_LEVEL, &budget);
 			}
 		}
 	}
+
+	// Composites last, their patches are queued before them.
+	for(i = 0; i < numtextures; i++) {
+		if(texturepresent[i]) R_PinComposite(i);
+	}
+
+	if(devparm) {
+		printf("R_PrecacheLevel: texture cache %i/%i bytes, %i hits, "
+		       "%i misses, %i rebuilds, %i evictions\n",
+		    texcachestats.used, texcachestats.budget, texcachestats.hits,
+		    texcachestats.misses, texcachestats.rebuilds,
+		    texcachestats.evictions);
+	}
 }
@@ -29,17 +29,45 @@
 #pragma interface
 #endif
 
+// Composite texture cache counters, see R_GetColumn.
+typedef struct {
+	int hits;
+	int misses;   // composites built for the first time
+	int rebuilds; // built again after they were evicted
+	int evictions;
+
+	// Bytes in use and the arena size
+	int used;
+	int budget;
+} texcachestats_t;
+
+extern texcachestats_t texcachestats;
+
 // Retrieve column data for span blitting.
 byte *R_GetColumn(int tex, int col);
 
 // I/O, setting up the stuff.
 void R_InitData(void);
+
+// Pins the graphics of the level and loads them in the background.
 void R_PrecacheLevel(void);
 
+// Waits for everything R_PrecacheLevel started.
+void R_WaitPrecache(void);
+
+// Reads the map at lumpnum and the graphics it needs
+//  in the background, for the intermission.
+void R_PreloadLevel(int lumpnum);
+void R_PreloadTicker(void);
+
+// Hands everything the level didn't claim back to the cache.
+void R_ReleasePreload(void);
+
 // Retrieval.
 // Floor/ceiling opaque texture tiles,
 // lookup by name. For animation?
 int R_FlatNumForName(char *name);
+int R_CheckFlatNumForName(char *name);
 
 // Called by P_Ticker for switches and animations,
 // returns the texture number for the texture name.
@@ -45,8 +45,6 @@
 #define SIL_TOP 2
 #define SIL_BOTH 3
 
-#define MAXDRAWSEGS 256
-
 //
 // INTERNAL MAP TYPES
 //  used by play and refresh
@@ -391,7 +389,7 @@ typedef struct {
 //
 // Now what is a visplane, anyway?
 //
-typedef struct {
+typedef struct visplane_s {
 	fixed_t height;
 	int picnum;
 	int lightlevel;
@@ -410,6 +408,9 @@ typedef struct {
 	byte bottom[SCREENWIDTH];
 	byte pad4;
 
+	// Hash chain, or the free list
+	struct visplane_s *next;
+
 } visplane_t;
 
 #endif
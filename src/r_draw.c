@@ -21,6 +21,13 @@
 //-----------------------------------------------------------------------------
 
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPAN_X86
+#endif
 
 #include "doomdef.h"
 
@@ -58,8 +65,29 @@ int scaledviewwidth;
 int viewheight;
 int viewwindowx;
 int viewwindowy;
-byte *ylookup[MAXHEIGHT];
-int columnofs[MAXWIDTH];
+byte **ylookup;
+int *columnofs;
+
+// Step from one pixel of a column to the next
+int columnpitch = SCREENWIDTH;
+
+// The view in screens[0]
+static byte *rowylookup[MAXHEIGHT];
+static int rowcolumnofs[MAXWIDTH];
+
+//
+// -columnbuffer
+// Walls go column by column into a buffer of their own first,
+//  each column contiguous in memory. R_FinishWalls moves them
+//  onto the screen, tile by tile, before the floors, ceilings
+//  and sprites are drawn in screens[0] as usual.
+// Walls never overlap the planes, only pixels no wall or plane
+//  covers (HOM) can show something different.
+//
+boolean columnbuffer;
+static byte viewbuffer[SCREENWIDTH * SCREENHEIGHT];
+static byte *colylookup[MAXHEIGHT];
+static int colcolumnofs[MAXWIDTH];
 
 // Color tables for different players,
 //  translate a limited part to another
@@ -71,15 +99,15 @@ byte translations[3][256];
 // R_DrawColumn
 // Source is the top of the column to scale.
 //
-lighttable_t *dc_colormap;
-int dc_x;
-int dc_yl;
-int dc_yh;
-fixed_t dc_iscale;
-fixed_t dc_texturemid;
+__thread lighttable_t *dc_colormap;
+__thread int dc_x;
+__thread int dc_yl;
+__thread int dc_yh;
+__thread fixed_t dc_iscale;
+__thread fixed_t dc_texturemid;
 
 // first pixel in a column (possibly virtual)
-byte *dc_source;
+__thread byte *dc_source;
 
 // just for profiling
 int dccount;
@@ -125,7 +153,7 @@ void R_DrawColumn(void) {
 		//  using a lighting/special effects LUT.
 		*dest = dc_colormap[dc_source[(frac >> FRACBITS) & 127]];
 
-		dest += SCREENWIDTH;
+		dest += columnpitch;
 		frac += fracstep;
 	}
 	while(count--);
@@ -220,8 +248,8 @@ void R_DrawColumnLow(void) {
 	do {
 		// Hack. Does not work corretly.
 		*dest2 = *dest = dc_colormap[dc_source[(frac >> FRACBITS) & 127]];
-		dest += SCREENWIDTH;
-		dest2 += SCREENWIDTH;
+		dest += columnpitch;
+		dest2 += columnpitch;
 		frac += fracstep;
 	}
 	while(count--);
@@ -230,7 +258,8 @@ void R_DrawColumnLow(void) {
 //
 // Spectre/Invisibility.
 //
-#define FUZZTABLE 50
+// Sprites are always drawn in screens[0], never in the
+//  column buffer, so the neighbours are SCREENWIDTH away.
 #define FUZZOFF (SCREENWIDTH)
 
 int fuzzoffset[FUZZTABLE] = {FUZZOFF, -FUZZOFF, FUZZOFF, -FUZZOFF, FUZZOFF,
@@ -241,7 +270,7 @@ int fuzzoffset[FUZZTABLE] = {FUZZOFF, -FUZZOFF, FUZZOFF, -FUZZOFF, FUZZOFF,
     -FUZZOFF, -FUZZOFF, -FUZZOFF, -FUZZOFF, FUZZOFF, FUZZOFF, FUZZOFF, FUZZOFF,
     -FUZZOFF, FUZZOFF, FUZZOFF, -FUZZOFF, FUZZOFF};
 
-int fuzzpos = 0;
+__thread int fuzzpos = 0;
 
 //
 // Framebuffer postprocessing.
@@ -334,7 +363,7 @@ void R_DrawFuzzColumn(void) {
 //  of the BaronOfHell, the HellKnight, uses
 //  identical sprites, kinda brightened up.
 //
-byte *dc_translation;
+__thread byte *dc_translation;
 byte *translationtables;
 
 void R_DrawTranslatedColumn(void) {
@@ -386,7 +415,7 @@ void R_DrawTranslatedColumn(void) {
 		// Thus the "green" ramp of the player 0 sprite
 		//  is mapped to gray, red, black/indigo.
 		*dest = dc_colormap[dc_translation[dc_source[frac >> FRACBITS]]];
-		dest += SCREENWIDTH;
+		dest += columnpitch;
 
 		frac += fracstep;
 	}
@@ -434,49 +463,39 @@ void R_InitTranslationTables(void) {
 // In consequence, flats are not stored by column (like walls),
 //  and the inner loop has to step in texture space u and v.
 //
-int ds_y;
-int ds_x1;
-int ds_x2;
+__thread int ds_y;
+__thread int ds_x1;
+__thread int ds_x2;
 
-lighttable_t *ds_colormap;
+__thread lighttable_t *ds_colormap;
 
-fixed_t ds_xfrac;
-fixed_t ds_yfrac;
-fixed_t ds_xstep;
-fixed_t ds_ystep;
+__thread fixed_t ds_xfrac;
+__thread fixed_t ds_yfrac;
+__thread fixed_t ds_xstep;
+__thread fixed_t ds_ystep;
 
 // start of a 64*64 tile image
-byte *ds_source;
+__thread byte *ds_source;
 
 // just for profiling
 int dscount;
 
 //
-// Draws the actual span.
-void R_DrawSpan(void) {
-	fixed_t xfrac;
-	fixed_t yfrac;
-	byte *dest;
-	int count;
-	int spot;
-
-#ifdef RANGECHECK
-	if(ds_x2 < ds_x1 || ds_x1 < 0 || ds_x2 >= SCREENWIDTH ||
-	    (unsigned) ds_y > SCREENHEIGHT) {
-		I_Error("R_DrawSpan: %i to %i at %i", ds_x1, ds_x2, ds_y);
-	}
-//	dscount++;
-#endif
-
-	xfrac = ds_xfrac;
-	yfrac = ds_yfrac;
-
-	dest = ylookup[ds_y] + columnofs[ds_x1];
+// Span kernels.
+// Each one draws count steps starting at xfrac / yfrac, using
+//  ds_xstep, ds_ystep, ds_source and ds_colormap. The low
+//  detail kernels write every texel twice.
+// The SIMD kernels compute 8 texel coordinates at a time and
+//  give exactly the same pixels as the plain C ones,
+//  R_InitSpans checks that before using them.
+//
+typedef void (*spankernel_t)(byte *dest, int count, fixed_t xfrac,
+    fixed_t yfrac);
 
-	// We do not check for zero spans here?
-	count = ds_x2 - ds_x1;
+static void span_c(byte *dest, int count, fixed_t xfrac, fixed_t yfrac) {
+	int spot;
 
-	do {
+	while(count-- > 0) {
 		// Current texture index in u,v.
 		spot = ((yfrac >> (16 - 6)) & (63 * 64)) + ((xfrac >> 16) & 63);
 
@@ -488,7 +507,259 @@ void R_DrawSpan(void) {
 		xfrac += ds_xstep;
 		yfrac += ds_ystep;
 	}
-	while(count--);
+}
+
+static void spanlow_c(byte *dest, int count, fixed_t xfrac, fixed_t yfrac) {
+	int spot;
+
+	while(count-- > 0) {
+		spot = ((yfrac >> (16 - 6)) & (63 * 64)) + ((xfrac >> 16) & 63);
+		// Lowres/blocky mode does it twice,
+		//  while scale is adjusted appropriately.
+		*dest++ = ds_colormap[ds_source[spot]];
+		*dest++ = ds_colormap[ds_source[spot]];
+
+		xfrac += ds_xstep;
+		yfrac += ds_ystep;
+	}
+}
+
+#ifdef SPAN_X86
+// Flat offsets for 4 steps, from xfrac / yfrac held in x and y
+__attribute__((target("sse2")))
+static inline __m128i spots_sse2(__m128i x, __m128i y) {
+	return _mm_or_si128(
+	    _mm_and_si128(_mm_srli_epi32(y, 16 - 6), _mm_set1_epi32(63 * 64)),
+	    _mm_and_si128(_mm_srli_epi32(x, 16), _mm_set1_epi32(63)));
+}
+
+// SSE2 has no gathers, only the coordinates are vectorized.
+__attribute__((target("sse2")))
+static void span_sse2(byte *dest, int count, fixed_t xfrac, fixed_t yfrac) {
+	int i, k;
+	int spots[8];
+	unsigned xs, ys;
+	__m128i x0, x1, y0, y1, xstep, ystep;
+
+	xs = ds_xstep;
+	ys = ds_ystep;
+	x0 = _mm_setr_epi32(xfrac, xfrac + xs, xfrac + 2 * xs, xfrac + 3 * xs);
+	y0 = _mm_setr_epi32(yfrac, yfrac + ys, yfrac + 2 * ys, yfrac + 3 * ys);
+	x1 = _mm_add_epi32(x0, _mm_set1_epi32(4 * xs));
+	y1 = _mm_add_epi32(y0, _mm_set1_epi32(4 * ys));
+	xstep = _mm_set1_epi32(8 * xs);
+	ystep = _mm_set1_epi32(8 * ys);
+
+	for(i = 0; i + 8 <= count; i += 8) {
+		_mm_storeu_si128((__m128i *) spots, spots_sse2(x0, y0));
+		_mm_storeu_si128((__m128i *) (spots + 4), spots_sse2(x1, y1));
+		for(k = 0; k < 8; k++) dest[k] = ds_colormap[ds_source[spots[k]]];
+
+		x0 = _mm_add_epi32(x0, xstep);
+		y0 = _mm_add_epi32(y0, ystep);
+		x1 = _mm_add_epi32(x1, xstep);
+		y1 = _mm_add_epi32(y1, ystep);
+		dest += 8;
+	}
+	span_c(dest, count - i, xfrac + i * xs, yfrac + i * ys);
+}
+
+__attribute__((target("sse2")))
+static void spanlow_sse2(byte *dest, int count, fixed_t xfrac, fixed_t yfrac) {
+	int i, k;
+	int spots[8];
+	unsigned xs, ys;
+	__m128i x0, x1, y0, y1, xstep, ystep;
+
+	xs = ds_xstep;
+	ys = ds_ystep;
+	x0 = _mm_setr_epi32(xfrac, xfrac + xs, xfrac + 2 * xs, xfrac + 3 * xs);
+	y0 = _mm_setr_epi32(yfrac, yfrac + ys, yfrac + 2 * ys, yfrac + 3 * ys);
+	x1 = _mm_add_epi32(x0, _mm_set1_epi32(4 * xs));
+	y1 = _mm_add_epi32(y0, _mm_set1_epi32(4 * ys));
+	xstep = _mm_set1_epi32(8 * xs);
+	ystep = _mm_set1_epi32(8 * ys);
+
+	for(i = 0; i + 8 <= count; i += 8) {
+		_mm_storeu_si128((__m128i *) spots, spots_sse2(x0, y0));
+		_mm_storeu_si128((__m128i *) (spots + 4), spots_sse2(x1, y1));
+		for(k = 0; k < 8; k++) {
+			dest[2 * k] = dest[2 * k + 1] =
+			    ds_colormap[ds_source[spots[k]]];
+		}
+
+		x0 = _mm_add_epi32(x0, xstep);
+		y0 = _mm_add_epi32(y0, ystep);
+		x1 = _mm_add_epi32(x1, xstep);
+		y1 = _mm_add_epi32(y1, ystep);
+		dest += 16;
+	}
+	spanlow_c(dest, count - i, xfrac + i * xs, yfrac + i * ys);
+}
+
+// Looks up 8 texels and packs them into the low 8 bytes.
+// The gathers load 4 bytes ending at the wanted one, so they
+//  never read past the end of the flat or the colormap.
+__attribute__((target("avx2")))
+static inline __m128i texels_avx2(__m256i x, __m256i y) {
+	__m256i spot, pix;
+
+	spot = _mm256_or_si256(
+	    _mm256_and_si256(_mm256_srli_epi32(y, 16 - 6), _mm256_set1_epi32(63 * 64)),
+	    _mm256_and_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(63)));
+
+	pix = _mm256_i32gather_epi32((int *) (ds_source - 3), spot, 1);
+	pix = _mm256_srli_epi32(pix, 24);
+	pix = _mm256_i32gather_epi32((int *) (ds_colormap - 3), pix, 1);
+	pix = _mm256_srli_epi32(pix, 24);
+
+	pix = _mm256_packus_epi32(pix, pix);
+	pix = _mm256_packus_epi16(pix, pix);
+	return _mm_unpacklo_epi32(
+	    _mm256_castsi256_si128(pix), _mm256_extracti128_si256(pix, 1));
+}
+
+__attribute__((target("avx2")))
+static void span_avx2(byte *dest, int count, fixed_t xfrac, fixed_t yfrac) {
+	int i;
+	unsigned xs, ys;
+	__m256i x, y, xstep, ystep, ramp;
+
+	xs = ds_xstep;
+	ys = ds_ystep;
+	ramp = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	x = _mm256_add_epi32(_mm256_set1_epi32(xfrac),
+	    _mm256_mullo_epi32(_mm256_set1_epi32(xs), ramp));
+	y = _mm256_add_epi32(_mm256_set1_epi32(yfrac),
+	    _mm256_mullo_epi32(_mm256_set1_epi32(ys), ramp));
+	xstep = _mm256_set1_epi32(8 * xs);
+	ystep = _mm256_set1_epi32(8 * ys);
+
+	for(i = 0; i + 8 <= count; i += 8) {
+		_mm_storel_epi64((__m128i *) dest, texels_avx2(x, y));
+
+		x = _mm256_add_epi32(x, xstep);
+		y = _mm256_add_epi32(y, ystep);
+		dest += 8;
+	}
+	span_c(dest, count - i, xfrac + i * xs, yfrac + i * ys);
+}
+
+__attribute__((target("avx2")))
+static void spanlow_avx2(byte *dest, int count, fixed_t xfrac, fixed_t yfrac) {
+	int i;
+	unsigned xs, ys;
+	__m128i pix;
+	__m256i x, y, xstep, ystep, ramp;
+
+	xs = ds_xstep;
+	ys = ds_ystep;
+	ramp = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	x = _mm256_add_epi32(_mm256_set1_epi32(xfrac),
+	    _mm256_mullo_epi32(_mm256_set1_epi32(xs), ramp));
+	y = _mm256_add_epi32(_mm256_set1_epi32(yfrac),
+	    _mm256_mullo_epi32(_mm256_set1_epi32(ys), ramp));
+	xstep = _mm256_set1_epi32(8 * xs);
+	ystep = _mm256_set1_epi32(8 * ys);
+
+	for(i = 0; i + 8 <= count; i += 8) {
+		pix = texels_avx2(x, y);
+		_mm_storeu_si128((__m128i *) dest, _mm_unpacklo_epi8(pix, pix));
+
+		x = _mm256_add_epi32(x, xstep);
+		y = _mm256_add_epi32(y, ystep);
+		dest += 16;
+	}
+	spanlow_c(dest, count - i, xfrac + i * xs, yfrac + i * ys);
+}
+#endif
+
+static spankernel_t spankernel = span_c;
+static spankernel_t spanlowkernel = spanlow_c;
+
+// 32 random bits, rand() only promises 15
+static fixed_t R_RandomFixed(void) {
+	return (unsigned) rand() ^ ((unsigned) rand() << 16);
+}
+
+//
+// R_CheckSpans
+// Runs a kernel pair against the C ones on random spans.
+//
+static boolean R_CheckSpans(spankernel_t span, spankernel_t spanlow) {
+	static byte flat[3 + 64 * 64];
+	static byte colormap[3 + 256];
+	static byte want[2 * SCREENWIDTH];
+	static byte got[2 * SCREENWIDTH];
+	int i, count;
+	fixed_t xfrac, yfrac;
+
+	for(i = 0; i < sizeof(flat); i++) flat[i] = rand();
+	for(i = 0; i < sizeof(colormap); i++) colormap[i] = rand();
+	ds_source = flat + 3;
+	ds_colormap = colormap + 3;
+
+	for(i = 0; i < 256; i++) {
+		count = 1 + rand() % SCREENWIDTH;
+		xfrac = R_RandomFixed();
+		yfrac = R_RandomFixed();
+		ds_xstep = R_RandomFixed();
+		ds_ystep = R_RandomFixed();
+
+		span_c(want, count, xfrac, yfrac);
+		span(got, count, xfrac, yfrac);
+		if(memcmp(want, got, count)) return false;
+
+		spanlow_c(want, count, xfrac, yfrac);
+		spanlow(got, count, xfrac, yfrac);
+		if(memcmp(want, got, 2 * count)) return false;
+	}
+
+	return true;
+}
+
+//
+// R_InitSpans
+// Picks the fastest span kernels the CPU supports.
+//
+void R_InitSpans(void) {
+	char *name;
+
+	name = "C";
+
+#ifdef SPAN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") &&
+	    R_CheckSpans(span_avx2, spanlow_avx2)) {
+		spankernel = span_avx2;
+		spanlowkernel = spanlow_avx2;
+		name = "AVX2";
+	}
+	else if(__builtin_cpu_supports("sse2") &&
+	    R_CheckSpans(span_sse2, spanlow_sse2)) {
+		spankernel = span_sse2;
+		spanlowkernel = spanlow_sse2;
+		name = "SSE2";
+	}
+#endif
+
+	printf("\nR_InitSpans: %s", name);
+}
+
+//
+// Draws the actual span.
+void R_DrawSpan(void) {
+#ifdef RANGECHECK
+	if(ds_x2 < ds_x1 || ds_x1 < 0 || ds_x2 >= SCREENWIDTH ||
+	    (unsigned) ds_y > SCREENHEIGHT) {
+		I_Error("R_DrawSpan: %i to %i at %i", ds_x1, ds_x2, ds_y);
+	}
+//	dscount++;
+#endif
+
+	// We do not check for zero spans here?
+	spankernel(ylookup[ds_y] + columnofs[ds_x1], ds_x2 - ds_x1 + 1, ds_xfrac,
+	    ds_yfrac);
 }
 
 // UNUSED.
@@ -567,12 +838,6 @@ void R_DrawSpan (void)
 // Again..
 //
 void R_DrawSpanLow(void) {
-	fixed_t xfrac;
-	fixed_t yfrac;
-	byte *dest;
-	int count;
-	int spot;
-
 #ifdef RANGECHECK
 	if(ds_x2 < ds_x1 || ds_x1 < 0 || ds_x2 >= SCREENWIDTH ||
 	    (unsigned) ds_y > SCREENHEIGHT) {
@@ -581,27 +846,14 @@ void R_DrawSpanLow(void) {
 //	dscount++;
 #endif
 
-	xfrac = ds_xfrac;
-	yfrac = ds_yfrac;
-
 	// Blocky mode, need to multiply by 2.
 	ds_x1 <<= 1;
 	ds_x2 <<= 1;
 
-	dest = ylookup[ds_y] + columnofs[ds_x1];
-
-	count = ds_x2 - ds_x1;
-	do {
-		spot = ((yfrac >> (16 - 6)) & (63 * 64)) + ((xfrac >> 16) & 63);
-		// Lowres/blocky mode does it twice,
-		//  while scale is adjusted appropriately.
-		*dest++ = ds_colormap[ds_source[spot]];
-		*dest++ = ds_colormap[ds_source[spot]];
-
-		xfrac += ds_xstep;
-		yfrac += ds_ystep;
-	}
-	while(count--);
+	// Steps once per pixel pair, yet for the doubled length,
+	//  so this has always drawn past ds_x2.
+	spanlowkernel(ylookup[ds_y] + columnofs[ds_x1], ds_x2 - ds_x1 + 1,
+	    ds_xfrac, ds_yfrac);
 }
 
 //
@@ -620,15 +872,74 @@ void R_InitBuffer(int width, int height) {
 	viewwindowx = (SCREENWIDTH - width) >> 1;
 
 	// Column offset. For windows.
-	for(i = 0; i < width; i++) columnofs[i] = viewwindowx + i;
+	for(i = 0; i < width; i++) {
+		rowcolumnofs[i] = viewwindowx + i;
+		colcolumnofs[i] = i * height;
+	}
 
 	// Samw with base row offset.
 	if(width == SCREENWIDTH) viewwindowy = 0;
 	else viewwindowy = (SCREENHEIGHT - SBARHEIGHT - height) >> 1;
 
 	// Preclaculate all row offsets.
-	for(i = 0; i < height; i++)
-		ylookup[i] = screens[0] + (i + viewwindowy) * SCREENWIDTH;
+	for(i = 0; i < height; i++) {
+		rowylookup[i] = screens[0] + (i + viewwindowy) * SCREENWIDTH;
+		colylookup[i] = viewbuffer + i;
+	}
+
+	ylookup = rowylookup;
+	columnofs = rowcolumnofs;
+	columnpitch = SCREENWIDTH;
+}
+
+//
+// R_BeginWalls
+// With -columnbuffer, switches the column drawers
+//  over to the column buffer.
+//
+void R_BeginWalls(void) {
+	if(!columnbuffer) return;
+
+	ylookup = colylookup;
+	columnofs = colcolumnofs;
+	columnpitch = 1;
+}
+
+//
+// R_FinishWalls
+// Copies the column buffer into screens[0] in 16x16 tiles,
+//  so both sides stay in the cache, and switches back.
+//
+#define TILE 16
+
+void R_FinishWalls(void) {
+	int x, y, tx, ty;
+	int x2, y2;
+	byte *src;
+	byte *dest;
+
+	if(ylookup != colylookup) return;
+
+	for(ty = 0; ty < viewheight; ty += TILE) {
+		y2 = ty + TILE < viewheight ? ty + TILE : viewheight;
+
+		for(tx = 0; tx < scaledviewwidth; tx += TILE) {
+			x2 = tx + TILE < scaledviewwidth ? tx + TILE : scaledviewwidth;
+
+			for(y = ty; y < y2; y++) {
+				src = colylookup[y] + colcolumnofs[tx];
+				dest = rowylookup[y] + rowcolumnofs[tx];
+				for(x = tx; x < x2; x++) {
+					*dest++ = *src;
+					src += viewheight;
+				}
+			}
+		}
+	}
+
+	ylookup = rowylookup;
+	columnofs = rowcolumnofs;
+	columnpitch = SCREENWIDTH;
 }
 
 //
@@ -707,6 +1018,15 @@ void R_FillBackScreen(void) {
 // Copy a screen buffer.
 //
 void R_VideoErase(unsigned ofs, int count) {
+	int y1, y2;
+
+	if(count <= 0) return;
+
+	y1 = ofs / SCREENWIDTH;
+	y2 = (ofs + count - 1) / SCREENWIDTH;
+	if(y1 == y2) V_MarkRect(ofs % SCREENWIDTH, y1, count, 1);
+	else V_MarkRect(0, y1, SCREENWIDTH, y2 - y1 + 1);
+
 	// LFB copy.
 	// This might not be a good idea if memcpy
 	//  is not optiomal, e.g. byte by byte on
@@ -720,8 +1040,6 @@ void R_VideoErase(unsigned ofs, int count) {
 // Draws the border around the view
 //  for different size windows?
 //
-void V_MarkRect(int x, int y, int width, int height);
-
 void R_DrawViewBorder(void) {
 	int top;
 	int side;
@@ -25,15 +25,17 @@
 #pragma interface
 #endif
 
-extern lighttable_t *dc_colormap;
-extern int dc_x;
-extern int dc_yl;
-extern int dc_yh;
-extern fixed_t dc_iscale;
-extern fixed_t dc_texturemid;
+// The drawer inputs are per thread, with -rthreads
+//  every drawing thread has its own set (see r_thread.c).
+extern __thread lighttable_t *dc_colormap;
+extern __thread int dc_x;
+extern __thread int dc_yl;
+extern __thread int dc_yh;
+extern __thread fixed_t dc_iscale;
+extern __thread fixed_t dc_texturemid;
 
 // first pixel in a column
-extern byte *dc_source;
+extern __thread byte *dc_source;
 
 // The span blitting interface.
 // Hook in assembler or system specific BLT
@@ -42,6 +44,10 @@ void R_DrawColumn(void);
 void R_DrawColumnLow(void);
 
 // The Spectre/Invisibility effect.
+#define FUZZTABLE 50
+
+extern __thread int fuzzpos;
+
 void R_DrawFuzzColumn(void);
 void R_DrawFuzzColumnLow(void);
 
@@ -53,22 +59,22 @@ void R_DrawTranslatedColumnLow(void);
 
 void R_VideoErase(unsigned ofs, int count);
 
-extern int ds_y;
-extern int ds_x1;
-extern int ds_x2;
+extern __thread int ds_y;
+extern __thread int ds_x1;
+extern __thread int ds_x2;
 
-extern lighttable_t *ds_colormap;
+extern __thread lighttable_t *ds_colormap;
 
-extern fixed_t ds_xfrac;
-extern fixed_t ds_yfrac;
-extern fixed_t ds_xstep;
-extern fixed_t ds_ystep;
+extern __thread fixed_t ds_xfrac;
+extern __thread fixed_t ds_yfrac;
+extern __thread fixed_t ds_xstep;
+extern __thread fixed_t ds_ystep;
 
 // start of a 64*64 tile image
-extern byte *ds_source;
+extern __thread byte *ds_source;
 
 extern byte *translationtables;
-extern byte *dc_translation;
+extern __thread byte *dc_translation;
 
 // Span blitting for rows, floor/ceiling.
 // No Sepctre effect needed.
@@ -77,8 +83,16 @@ void R_DrawSpan(void);
 // Low resolution mode, 160x200?
 void R_DrawSpanLow(void);
 
+// Picks the span kernels, SIMD ones where the CPU has them.
+void R_InitSpans(void);
+
 void R_InitBuffer(int width, int height);
 
+// -columnbuffer: walls are drawn column major, between these two.
+extern boolean columnbuffer;
+void R_BeginWalls(void);
+void R_FinishWalls(void);
+
 // Initialize color translation tables,
 //  for player rendering etc.
 void R_InitTranslationTables(void);
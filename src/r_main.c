@@ -26,10 +26,15 @@
 #include "d_net.h"
 #include "doomdef.h"
 
+#include "m_argv.h"
 #include "m_bbox.h"
 
 #include "r_local.h"
+#include "r_pvs.h"
 #include "r_sky.h"
+#include "r_thread.h"
+
+#include "v_video.h"
 
 // Fineangles in the SCREENWIDTH wide window.
 #define FIELDOFVIEW 2048
@@ -574,6 +579,8 @@ void R_ExecuteSetViewSize(void) {
 		spanfunc = R_DrawSpanLow;
 	}
 
+	R_QueueDrawers();
+
 	R_InitBuffer(scaledviewwidth, viewheight);
 
 	R_InitTextureMapping();
@@ -628,6 +635,9 @@ void R_Init(void) {
 	R_InitTables();
 	// viewwidth / viewheight / detailLevel are set by the defaults
 	printf("\nR_InitTables");
+	R_InitThreads();
+	R_InitSpans();
+	columnbuffer = M_CheckParm("-columnbuffer");
 
 	R_SetViewSize(screenblocks, detailLevel);
 	R_InitPlanes();
@@ -712,9 +722,18 @@ void R_RenderPlayerView(player_t *player) {
 	// check for new console commands.
 	NetUpdate();
 
+	R_BeginWalls();
+	R_SetupPVS();
+
 	// The head node is the last node output.
 	R_RenderBSPNode(numnodes - 1);
 
+	// Walls are done, draw them and move them to screens[0].
+	if(columnbuffer) {
+		R_FlushDraws();
+		R_FinishWalls();
+	}
+
 	// Check for new console commands.
 	NetUpdate();
 
@@ -725,6 +744,11 @@ void R_RenderPlayerView(player_t *player) {
 
 	R_DrawMasked();
 
+	// With -rthreads nothing is drawn yet.
+	R_FlushDraws();
+
+	V_MarkRect(viewwindowx, viewwindowy, scaledviewwidth, viewheight);
+
 	// Check for new console commands.
 	NetUpdate();
 }
@@ -20,6 +20,7 @@
 //
 //-----------------------------------------------------------------------------
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "i_system.h"
@@ -40,16 +41,32 @@ planefunction_t ceilingfunc;
 //
 
 // Here comes the obnoxious "visplane".
-#define MAXVISPLANES 128
-visplane_t visplanes[MAXVISPLANES];
-visplane_t *lastvisplane;
+// Planes in use are kept in visplanes[], in the order they
+//  were made. The first plane for each height, picnum and
+//  lightlevel goes into the hash, that is the one the old
+//  linear search found. Unused planes wait in freeplanes.
+#define VISPLANEHASH 128
+static visplane_t *visplanehash[VISPLANEHASH];
+static visplane_t **visplanes;
+static visplane_t *freeplanes;
+static int maxvisplanes;
 visplane_t *floorplane;
 visplane_t *ceilingplane;
 
-// ?
-#define MAXOPENINGS SCREENWIDTH * 64
-short openings[MAXOPENINGS];
-short *lastopening;
+// Openings come in chunks, each twice the size of the last.
+//  Drawsegs point into them, so they never move.
+#define OPENINGCHUNK (SCREENWIDTH * 64)
+#define MAXOPENINGCHUNKS 16
+static short *openingchunks[MAXOPENINGCHUNKS];
+static int openingchunk;
+static short *lastopening;
+static short *openingend;
+
+// Usage this frame and the most used in any frame
+int numvisplanes;
+int numopenings;
+int peakvisplanes;
+int peakopenings;
 
 //
 // Clip values are the solid pixel bounding the range.
@@ -163,8 +180,19 @@ void R_ClearPlanes(void) {
 		ceilingclip[i] = -1;
 	}
 
-	lastvisplane = visplanes;
-	lastopening = openings;
+	for(i = 0; i < numvisplanes; i++) {
+		visplanes[i]->next = freeplanes;
+		freeplanes = visplanes[i];
+	}
+	numvisplanes = 0;
+	memset(visplanehash, 0, sizeof(visplanehash));
+
+	if(!openingchunks[0])
+		openingchunks[0] = Z_Malloc(OPENINGCHUNK * sizeof(short), PU_STATIC, 0);
+	openingchunk = 0;
+	lastopening = openingchunks[0];
+	openingend = lastopening + OPENINGCHUNK;
+	numopenings = 0;
 
 	// texture calculation
 	memset(cachedheight, 0, sizeof(cachedheight));
@@ -177,34 +205,90 @@ void R_ClearPlanes(void) {
 	baseyscale = -FixedDiv(finesine[angle], centerxfrac);
 }
 
+//
+// R_AllocOpenings
+// Room for count clip values, a seg never needs more than
+//  viewwidth of them.
+//
+short *R_AllocOpenings(int count) {
+	short *openings;
+	int size;
+
+	if(lastopening + count > openingend) {
+		if(++openingchunk == MAXOPENINGCHUNKS)
+			I_Error("R_AllocOpenings: no more openings");
+
+		size = OPENINGCHUNK << openingchunk;
+		if(!openingchunks[openingchunk]) {
+			openingchunks[openingchunk] =
+			    Z_Malloc(size * sizeof(short), PU_STATIC, 0);
+		}
+		lastopening = openingchunks[openingchunk];
+		openingend = lastopening + size;
+	}
+
+	openings = lastopening;
+	lastopening += count;
+	numopenings += count;
+
+	return openings;
+}
+
+//
+// R_NewPlane
+// Takes a plane from the free list, or makes a new one.
+//
+static visplane_t *R_NewPlane(fixed_t height, int picnum, int lightlevel) {
+	visplane_t *pl;
+
+	if(numvisplanes == maxvisplanes) {
+		maxvisplanes = maxvisplanes ? maxvisplanes * 2 : 128;
+		visplanes = realloc(visplanes, maxvisplanes * sizeof(visplane_t *));
+		if(!visplanes) I_Error("R_NewPlane: no more visplanes");
+	}
+
+	if(freeplanes) {
+		pl = freeplanes;
+		freeplanes = pl->next;
+	}
+	else pl = Z_Malloc(sizeof(visplane_t), PU_STATIC, 0);
+
+	visplanes[numvisplanes++] = pl;
+
+	pl->height = height;
+	pl->picnum = picnum;
+	pl->lightlevel = lightlevel;
+	pl->next = NULL;
+
+	return pl;
+}
+
 //
 // R_FindPlane
 //
 visplane_t *R_FindPlane(fixed_t height, int picnum, int lightlevel) {
 	visplane_t *check;
+	unsigned hash;
 
 	if(picnum == skyflatnum) {
 		height = 0; // all skys map together
 		lightlevel = 0;
 	}
 
-	for(check = visplanes; check < lastvisplane; check++) {
+	hash = ((unsigned) height >> FRACBITS) * 7 + picnum * 3 + lightlevel;
+	hash &= VISPLANEHASH - 1;
+
+	for(check = visplanehash[hash]; check; check = check->next) {
 		if(height == check->height && picnum == check->picnum &&
 		    lightlevel == check->lightlevel) {
-			break;
+			return check;
 		}
 	}
 
-	if(check < lastvisplane) return check;
-
-	if(lastvisplane - visplanes == MAXVISPLANES)
-		I_Error("R_FindPlane: no more visplanes");
-
-	lastvisplane++;
+	check = R_NewPlane(height, picnum, lightlevel);
+	check->next = visplanehash[hash];
+	visplanehash[hash] = check;
 
-	check->height = height;
-	check->picnum = picnum;
-	check->lightlevel = lightlevel;
 	check->minx = SCREENWIDTH;
 	check->maxx = -1;
 
@@ -253,11 +337,7 @@ visplane_t *R_CheckPlane(visplane_t *pl, int start, int stop) {
 	}
 
 	// make a new visplane
-	lastvisplane->height = pl->height;
-	lastvisplane->picnum = pl->picnum;
-	lastvisplane->lightlevel = pl->lightlevel;
-
-	pl = lastvisplane++;
+	pl = R_NewPlane(pl->height, pl->picnum, pl->lightlevel);
 	pl->minx = start;
 	pl->maxx = stop;
 
@@ -295,24 +375,24 @@ void R_MakeSpans(int x, int t1, int b1, int t2, int b2) {
 //
 void R_DrawPlanes(void) {
 	visplane_t *pl;
+	int i;
 	int light;
 	int x;
 	int stop;
 	int angle;
 
-#ifdef RANGECHECK
-	if(ds_p - drawsegs > MAXDRAWSEGS)
-		I_Error("R_DrawPlanes: drawsegs overflow (%i)", ds_p - drawsegs);
-
-	if(lastvisplane - visplanes > MAXVISPLANES)
-		I_Error(
-		    "R_DrawPlanes: visplane overflow (%i)", lastvisplane - visplanes);
+	if(numvisplanes > peakvisplanes) {
+		peakvisplanes = numvisplanes;
+		if(devparm) printf("R_DrawPlanes: %i visplanes\n", peakvisplanes);
+	}
+	if(numopenings > peakopenings) {
+		peakopenings = numopenings;
+		if(devparm) printf("R_DrawPlanes: %i openings\n", peakopenings);
+	}
 
-	if(lastopening - openings > MAXOPENINGS)
-		I_Error("R_DrawPlanes: opening overflow (%i)", lastopening - openings);
-#endif
+	for(i = 0; i < numvisplanes; i++) {
+		pl = visplanes[i];
 
-	for(pl = visplanes; pl < lastvisplane; pl++) {
 		if(pl->minx > pl->maxx) continue;
 
 		// sky flat
@@ -340,8 +420,11 @@ void R_DrawPlanes(void) {
 		}
 
 		// regular flat
+		// Nothing is allocated while the spans are drawn, so
+		//  PU_CACHE is enough and a flat pinned by R_PrecacheLevel
+		//  keeps its tag.
 		ds_source =
-		    W_CacheLumpNum(firstflat + flattranslation[pl->picnum], PU_STATIC);
+		    W_CacheLumpNum(firstflat + flattranslation[pl->picnum], PU_CACHE);
 
 		planeheight = abs(pl->height - viewz);
 		light = (pl->lightlevel >> LIGHTSEGSHIFT) + extralight;
@@ -361,7 +444,5 @@ void R_DrawPlanes(void) {
 			R_MakeSpans(x, pl->top[x - 1], pl->bottom[x - 1], pl->top[x],
 			    pl->bottom[x]);
 		}
-
-		Z_ChangeTag(ds_source, PU_CACHE);
 	}
 }
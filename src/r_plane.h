@@ -28,7 +28,11 @@
 #endif
 
 // Visplane related.
-extern short *lastopening;
+// Used this frame, and the most used in any frame so far.
+extern int numvisplanes;
+extern int numopenings;
+extern int peakvisplanes;
+extern int peakopenings;
 
 typedef void (*planefunction_t)(int top, int bottom);
 
@@ -54,4 +58,7 @@ visplane_t *R_FindPlane(fixed_t height, int picnum, int lightlevel);
 
 visplane_t *R_CheckPlane(visplane_t *pl, int start, int stop);
 
+// Space for count sprite clip / masked texture column values.
+short *R_AllocOpenings(int count);
+
 #endif
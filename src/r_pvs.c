@@ -0,0 +1,888 @@
+//-----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 by Fabillotic
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+// DESCRIPTION:
+//	Potentially visible set (PVS) of every subsector.
+//	The BSP cells are cut out of the map's bounding box, the open
+//	 parts of the boundaries between two cells become portals.
+//	 Only one sided segs close a portal, heights are ignored since
+//	 doors and lifts move. From every subsector the portals are
+//	 then followed as long as a straight line can still pass
+//	 through all of them, like Quake's vis does.
+//	No portal is closed for being short, so the result is a
+//	 superset of what the renderer could ever reach from the
+//	 subsector. The walls of everything else are skipped; its
+//	 things are still collected, since a sprite can stick out
+//	 of the subsector it stands in. The frame stays the same.
+//
+//	  -pvs            use the PVS, build it on load if needed
+//	  -pvsdir <dir>   where the PVS files are cached (default pvs)
+//	  -buildpvs       cache the PVS of every map and quit
+//
+//-----------------------------------------------------------------------------
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "p_setup.h"
+#include "r_local.h"
+#include "r_pvs.h"
+#include "w_wad.h"
+#include "z_zone.h"
+
+#define FIXED2DOUBLE(x) ((x) / (double) FRACUNIT)
+
+#define PVS_VERSION 2
+#define PVS_MAXTHREADS 64
+
+// Distance from a line that still counts as on it
+#define PVS_EPSILON 0.01
+
+// Separators shorter than this give no direction and are skipped,
+//  which only ever lets the flow see more.
+#define PVS_MINLEN 0.05
+
+// Steps of the flow from one subsector before it gives up
+//  and just sees everything.
+#define PVS_MAXWORK (1 << 18)
+
+typedef struct {
+	double x;
+	double y;
+} pvspoint_t;
+
+typedef struct {
+	pvspoint_t p[2];
+
+	// nx * x + ny * y > d on the side of leaf
+	double nx;
+	double ny;
+	double d;
+
+	// Subsector the portal leads into
+	int leaf;
+
+	// Next portal out of the same subsector
+	int next;
+} pvsportal_t;
+
+// Part of a splitting line that lies on the border of leaf
+typedef struct {
+	int leaf;
+	double t0;
+	double t1;
+} pvspiece_t;
+
+typedef struct {
+	byte *row;
+	byte *onstack;
+	int work;
+} pvsflow_t;
+
+byte *pvsrow;
+byte *pvsnodes;
+
+// Current level, RLE compressed rows
+static byte *pvsdata;
+static int pvssize;
+static int *pvsofs;
+static int pvsleaf;
+
+// Portals, only while building
+static pvsportal_t *portals;
+static int numportals;
+static int maxportals;
+static int *leafportals;
+
+static pvspiece_t *pieces[2];
+static int numpieces[2];
+static int maxpieces[2];
+
+static double *blocks;
+static int maxblocks;
+
+// Worker state, only while building
+static int rowbytes;
+static byte **rows;
+static int *rowsizes;
+static int nextleaf;
+static int overflows;
+static pthread_mutex_t pvs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// PVS_Grow
+// Doubles a growable array once it is full.
+//
+static void *PVS_Grow(void *array, int *max, int count, int size) {
+	if(count < *max) return array;
+
+	*max = *max ? *max * 2 : 256;
+	array = realloc(array, *max * size);
+	if(!array) I_Error("R_LoadPVS: out of memory");
+	return array;
+}
+
+//
+// PVS_PushPiece
+// Sends the part [t0, t1] of the line o + t * u down the tree,
+//  until it is cut into the borders of single subsectors.
+//
+static void PVS_PushPiece(int bspnum, pvspoint_t o, pvspoint_t u, double t0,
+    double t1, int side) {
+	node_t *node;
+	pvspiece_t *piece;
+	double ox, oy, ux, uy, len;
+	double s0, s1, tm;
+
+	if(bspnum & NF_SUBSECTOR) {
+		pieces[side] = PVS_Grow(pieces[side], &maxpieces[side],
+		    numpieces[side], sizeof(pvspiece_t));
+		piece = &pieces[side][numpieces[side]++];
+		piece->leaf = bspnum & ~NF_SUBSECTOR;
+		piece->t0 = t0;
+		piece->t1 = t1;
+		return;
+	}
+
+	node = &nodes[bspnum];
+	ox = FIXED2DOUBLE(node->x);
+	oy = FIXED2DOUBLE(node->y);
+	ux = FIXED2DOUBLE(node->dx);
+	uy = FIXED2DOUBLE(node->dy);
+	len = sqrt(ux * ux + uy * uy);
+	ux /= len;
+	uy /= len;
+
+	// Negative is in front, like R_PointOnSide
+	s0 = ux * (o.y + u.y * t0 - oy) - uy * (o.x + u.x * t0 - ox);
+	s1 = ux * (o.y + u.y * t1 - oy) - uy * (o.x + u.x * t1 - ox);
+
+	if(fabs(s0) <= PVS_EPSILON && fabs(s1) <= PVS_EPSILON) {
+		// On the partition line itself, could touch both sides
+		PVS_PushPiece(node->children[0], o, u, t0, t1, side);
+		PVS_PushPiece(node->children[1], o, u, t0, t1, side);
+	}
+	else if(s0 <= PVS_EPSILON && s1 <= PVS_EPSILON)
+		PVS_PushPiece(node->children[0], o, u, t0, t1, side);
+	else if(s0 >= -PVS_EPSILON && s1 >= -PVS_EPSILON)
+		PVS_PushPiece(node->children[1], o, u, t0, t1, side);
+	else {
+		tm = t0 + (t1 - t0) * s0 / (s0 - s1);
+		PVS_PushPiece(node->children[s0 > 0], o, u, t0, tm, side);
+		PVS_PushPiece(node->children[s1 > 0], o, u, tm, t1, side);
+	}
+}
+
+//
+// PVS_AddPortal
+// Adds the portal between the points a and b,
+//  leading into leaf through the side n.
+//
+static void PVS_AddPortal(
+    int from, int leaf, pvspoint_t a, pvspoint_t b, double nx, double ny) {
+	pvsportal_t *portal;
+
+	portals = PVS_Grow(portals, &maxportals, numportals, sizeof(pvsportal_t));
+	portal = &portals[numportals];
+	portal->p[0] = a;
+	portal->p[1] = b;
+	portal->nx = nx;
+	portal->ny = ny;
+	portal->d = nx * a.x + ny * a.y;
+	portal->leaf = leaf;
+	portal->next = leafportals[from];
+	leafportals[from] = numportals++;
+}
+
+//
+// PVS_AddBlocks
+// Collects the one sided segs of leaf that lie on the line.
+//
+static int PVS_AddBlocks(int leaf, pvspoint_t o, pvspoint_t u, int count) {
+	int i;
+	seg_t *seg;
+	double x1, y1, x2, y2;
+	double t1, t2;
+
+	seg = &segs[subsectors[leaf].firstline];
+	for(i = 0; i < subsectors[leaf].numlines; i++, seg++) {
+		if(seg->backsector) continue;
+
+		x1 = FIXED2DOUBLE(seg->v1->x);
+		y1 = FIXED2DOUBLE(seg->v1->y);
+		x2 = FIXED2DOUBLE(seg->v2->x);
+		y2 = FIXED2DOUBLE(seg->v2->y);
+
+		if(fabs(u.x * (y1 - o.y) - u.y * (x1 - o.x)) > PVS_EPSILON ||
+		    fabs(u.x * (y2 - o.y) - u.y * (x2 - o.x)) > PVS_EPSILON)
+			continue;
+
+		t1 = (x1 - o.x) * u.x + (y1 - o.y) * u.y;
+		t2 = (x2 - o.x) * u.x + (y2 - o.y) * u.y;
+
+		blocks = PVS_Grow(blocks, &maxblocks, count + 1, 2 * sizeof(double));
+		blocks[count * 2] = t1 < t2 ? t1 : t2;
+		blocks[count * 2 + 1] = t1 < t2 ? t2 : t1;
+		count++;
+	}
+
+	return count;
+}
+
+static int PVS_CompareBlocks(const void *a, const void *b) {
+	double d;
+
+	d = *(double *) a - *(double *) b;
+	return d < 0 ? -1 : d > 0;
+}
+
+//
+// PVS_MatchPieces
+// Pairs up the pieces on both sides of a splitting line
+//  and turns what walls leave open into portals.
+//
+static void PVS_MatchPieces(pvspoint_t o, pvspoint_t u) {
+	pvspiece_t *f, *b;
+	pvspoint_t p1, p2;
+	double t0, t1, t;
+	int i, j, k, count;
+
+	for(i = 0; i < numpieces[0]; i++) {
+		f = &pieces[0][i];
+		for(j = 0; j < numpieces[1]; j++) {
+			b = &pieces[1][j];
+			if(f->leaf == b->leaf) continue;
+
+			t0 = f->t0 > b->t0 ? f->t0 : b->t0;
+			t1 = f->t1 < b->t1 ? f->t1 : b->t1;
+			if(t1 <= t0) continue;
+
+			count = PVS_AddBlocks(f->leaf, o, u, 0);
+			count = PVS_AddBlocks(b->leaf, o, u, count);
+			qsort(blocks, count, 2 * sizeof(double), PVS_CompareBlocks);
+
+			// Whatever the walls leave open is a portal
+			for(k = 0; k <= count && t0 < t1; k++) {
+				t = k < count && blocks[k * 2] < t1 ? blocks[k * 2] : t1;
+				if(t > t0) {
+					p1.x = o.x + u.x * t0;
+					p1.y = o.y + u.y * t0;
+					p2.x = o.x + u.x * t;
+					p2.y = o.y + u.y * t;
+					PVS_AddPortal(f->leaf, b->leaf, p1, p2, -u.y, u.x);
+					PVS_AddPortal(b->leaf, f->leaf, p1, p2, u.y, -u.x);
+				}
+				if(k < count && blocks[k * 2 + 1] > t0)
+					t0 = blocks[k * 2 + 1];
+			}
+		}
+	}
+}
+
+//
+// PVS_Portalize
+// Splits the convex cell of a node along its partition line
+//  and finds the portals on that line.
+//
+static void PVS_Portalize(int bspnum, pvspoint_t *cell, int count) {
+	node_t *node;
+	pvspoint_t *front, *back;
+	pvspoint_t o, u, p, *a, *b;
+	double len, da, db, t, tmin, tmax;
+	int i, numfront, numback;
+
+	if(bspnum & NF_SUBSECTOR) return;
+
+	node = &nodes[bspnum];
+	o.x = FIXED2DOUBLE(node->x);
+	o.y = FIXED2DOUBLE(node->y);
+	u.x = FIXED2DOUBLE(node->dx);
+	u.y = FIXED2DOUBLE(node->dy);
+	len = sqrt(u.x * u.x + u.y * u.y);
+	u.x /= len;
+	u.y /= len;
+
+	front = malloc((count + 2) * sizeof(pvspoint_t));
+	back = malloc((count + 2) * sizeof(pvspoint_t));
+	if(!front || !back) I_Error("R_LoadPVS: out of memory");
+
+	numfront = numback = 0;
+	tmin = 1e30;
+	tmax = -1e30;
+	for(i = 0; i < count; i++) {
+		a = &cell[i];
+		b = &cell[(i + 1) % count];
+		da = u.x * (a->y - o.y) - u.y * (a->x - o.x);
+		db = u.x * (b->y - o.y) - u.y * (b->x - o.x);
+
+		if(da <= PVS_EPSILON) front[numfront++] = *a;
+		if(da >= -PVS_EPSILON) back[numback++] = *a;
+
+		if(fabs(da) <= PVS_EPSILON) p = *a;
+		else if((da < -PVS_EPSILON && db > PVS_EPSILON) ||
+		        (da > PVS_EPSILON && db < -PVS_EPSILON)) {
+			p.x = a->x + (b->x - a->x) * da / (da - db);
+			p.y = a->y + (b->y - a->y) * da / (da - db);
+			front[numfront++] = p;
+			back[numback++] = p;
+		}
+		else continue;
+
+		t = (p.x - o.x) * u.x + (p.y - o.y) * u.y;
+		if(t < tmin) tmin = t;
+		if(t > tmax) tmax = t;
+	}
+
+	if(tmax > tmin) {
+		numpieces[0] = numpieces[1] = 0;
+		PVS_PushPiece(node->children[0], o, u, tmin, tmax, 0);
+		PVS_PushPiece(node->children[1], o, u, tmin, tmax, 1);
+		PVS_MatchPieces(o, u);
+	}
+
+	if(numfront >= 3) PVS_Portalize(node->children[0], front, numfront);
+	if(numback >= 3) PVS_Portalize(node->children[1], back, numback);
+
+	free(front);
+	free(back);
+}
+
+//
+// PVS_Clip
+// Keeps the part of w with nx * x + ny * y >= d.
+// Returns false if nothing is left.
+//
+static boolean PVS_Clip(pvspoint_t *w, double nx, double ny, double d) {
+	double d0, d1, t;
+	pvspoint_t p;
+
+	d0 = nx * w[0].x + ny * w[0].y - d + PVS_EPSILON;
+	d1 = nx * w[1].x + ny * w[1].y - d + PVS_EPSILON;
+
+	if(d0 < 0 && d1 < 0) return false;
+	if(d0 >= 0 && d1 >= 0) return true;
+
+	t = d0 / (d0 - d1);
+	p.x = w[0].x + (w[1].x - w[0].x) * t;
+	p.y = w[0].y + (w[1].y - w[0].y) * t;
+	if(d0 < 0) w[0] = p;
+	else w[1] = p;
+
+	return true;
+}
+
+//
+// PVS_ClipSeparators
+// Keeps the part of target that a line through
+//  source and pass can reach.
+//
+static boolean PVS_ClipSeparators(
+    pvspoint_t *source, pvspoint_t *pass, pvspoint_t *target) {
+	int i, j;
+	double nx, ny, len, d, ds, dp;
+
+	for(i = 0; i < 2; i++) {
+		for(j = 0; j < 2; j++) {
+			nx = source[i].y - pass[j].y;
+			ny = pass[j].x - source[i].x;
+			len = sqrt(nx * nx + ny * ny);
+			if(len < PVS_MINLEN) continue;
+			nx /= len;
+			ny /= len;
+			d = nx * source[i].x + ny * source[i].y;
+
+			// A separator has the rest of the source
+			//  and the rest of the pass on opposite sides.
+			ds = nx * source[!i].x + ny * source[!i].y - d;
+			dp = nx * pass[!j].x + ny * pass[!j].y - d;
+			if(fabs(dp) <= PVS_EPSILON) continue;
+			if(fabs(ds) > PVS_EPSILON && (ds > 0) == (dp > 0)) continue;
+
+			if(dp < 0) {
+				nx = -nx;
+				ny = -ny;
+				d = -d;
+			}
+			if(!PVS_Clip(target, nx, ny, d)) return false;
+		}
+	}
+
+	return true;
+}
+
+//
+// PVS_Flow
+// Marks leaf and follows its portals, source is what is left of the
+//  portal out of the first subsector, pass the one into leaf.
+//
+static void PVS_Flow(pvsflow_t *flow, int leaf, pvsportal_t *first,
+    pvspoint_t *source, pvspoint_t *pass) {
+	pvsportal_t *portal;
+	pvspoint_t target[2];
+	pvspoint_t clipped[2];
+	int i;
+
+	flow->row[leaf >> 3] |= 1 << (leaf & 7);
+	if(++flow->work > PVS_MAXWORK) return;
+
+	flow->onstack[leaf] = 1;
+
+	for(i = leafportals[leaf]; i >= 0; i = portal->next) {
+		portal = &portals[i];
+
+		// A straight line passes every convex leaf only once
+		if(flow->onstack[portal->leaf]) continue;
+
+		// Has to lead away from the first portal
+		target[0] = portal->p[0];
+		target[1] = portal->p[1];
+		if(first->nx * target[0].x + first->ny * target[0].y <=
+		        first->d + PVS_EPSILON &&
+		    first->nx * target[1].x + first->ny * target[1].y <=
+		        first->d + PVS_EPSILON)
+			continue;
+		if(!PVS_Clip(target, first->nx, first->ny, first->d)) continue;
+
+		clipped[0] = source[0];
+		clipped[1] = source[1];
+		if(pass) {
+			if(!PVS_ClipSeparators(source, pass, target)) continue;
+			if(!PVS_ClipSeparators(target, pass, clipped)) continue;
+		}
+
+		PVS_Flow(flow, portal->leaf, first, clipped, target);
+	}
+
+	flow->onstack[leaf] = 0;
+}
+
+//
+// PVS_CompressRow
+// Runs of zero bytes become a zero and a count, like in Quake.
+//
+static int PVS_CompressRow(byte *row, byte *out) {
+	byte *dest;
+	int i, rep;
+
+	dest = out;
+	for(i = 0; i < rowbytes; i++) {
+		*dest++ = row[i];
+		if(row[i]) continue;
+
+		rep = 1;
+		while(i + 1 < rowbytes && !row[i + 1] && rep < 255) {
+			i++;
+			rep++;
+		}
+		*dest++ = rep;
+	}
+
+	return dest - out;
+}
+
+//
+// PVS_DecompressRow
+// False if the row runs past inend or doesn't fill out exactly,
+//  the rest of out is then marked visible.
+//
+static boolean PVS_DecompressRow(byte *in, byte *inend, byte *out) {
+	byte *end;
+
+	end = out + rowbytes;
+	while(out < end && in < inend) {
+		if(*in) {
+			*out++ = *in++;
+			continue;
+		}
+
+		if(inend - in < 2 || !in[1] || in[1] > end - out) break;
+
+		memset(out, 0, in[1]);
+		out += in[1];
+		in += 2;
+	}
+
+	if(out == end) return true;
+
+	memset(out, 0xff, end - out);
+	return false;
+}
+
+static void *PVS_Worker(void *arg) {
+	pvsflow_t flow;
+	pvsportal_t *portal;
+	byte *out;
+	int leaf, i;
+
+	(void) arg;
+
+	flow.row = malloc(rowbytes);
+	flow.onstack = calloc(numsubsectors, 1);
+	out = malloc(rowbytes * 2);
+	if(!flow.row || !flow.onstack || !out)
+		I_Error("R_LoadPVS: out of memory");
+
+	for(;;) {
+		pthread_mutex_lock(&pvs_mutex);
+		leaf = nextleaf++;
+		pthread_mutex_unlock(&pvs_mutex);
+		if(leaf >= numsubsectors) break;
+
+		memset(flow.row, 0, rowbytes);
+		flow.row[leaf >> 3] |= 1 << (leaf & 7);
+		flow.work = 0;
+
+		flow.onstack[leaf] = 1;
+		for(i = leafportals[leaf]; i >= 0; i = portal->next) {
+			portal = &portals[i];
+			PVS_Flow(&flow, portal->leaf, portal, portal->p, NULL);
+		}
+		flow.onstack[leaf] = 0;
+
+		if(flow.work > PVS_MAXWORK) {
+			memset(flow.row, 0xff, rowbytes);
+			pthread_mutex_lock(&pvs_mutex);
+			overflows++;
+			pthread_mutex_unlock(&pvs_mutex);
+		}
+
+		rowsizes[leaf] = PVS_CompressRow(flow.row, out);
+		rows[leaf] = malloc(rowsizes[leaf]);
+		if(!rows[leaf]) I_Error("R_LoadPVS: out of memory");
+		memcpy(rows[leaf], out, rowsizes[leaf]);
+	}
+
+	free(flow.row);
+	free(flow.onstack);
+	free(out);
+	return NULL;
+}
+
+//
+// PVS_Build
+// Computes the PVS of the loaded map into pvsdata / pvsofs.
+//
+static void PVS_Build(void) {
+	pthread_t threads[PVS_MAXTHREADS];
+	pthread_attr_t attr;
+	pvspoint_t box[4];
+	double x, y;
+	int i, numthreads, size;
+	unsigned start;
+
+	start = I_GetTimeUS();
+
+	// The whole map with some room around it
+	box[0].x = box[0].y = 1e30;
+	box[2].x = box[2].y = -1e30;
+	for(i = 0; i < numvertexes; i++) {
+		x = FIXED2DOUBLE(vertexes[i].x);
+		y = FIXED2DOUBLE(vertexes[i].y);
+		if(x < box[0].x) box[0].x = x;
+		if(y < box[0].y) box[0].y = y;
+		if(x > box[2].x) box[2].x = x;
+		if(y > box[2].y) box[2].y = y;
+	}
+	box[0].x -= 64;
+	box[0].y -= 64;
+	box[2].x += 64;
+	box[2].y += 64;
+	box[1].x = box[2].x;
+	box[1].y = box[0].y;
+	box[3].x = box[0].x;
+	box[3].y = box[2].y;
+
+	leafportals = malloc(numsubsectors * sizeof(int));
+	if(!leafportals) I_Error("R_LoadPVS: out of memory");
+	for(i = 0; i < numsubsectors; i++) leafportals[i] = -1;
+	numportals = 0;
+
+	PVS_Portalize(numnodes - 1, box, 4);
+
+	rowbytes = (numsubsectors + 7) >> 3;
+	rows = malloc(numsubsectors * sizeof(byte *));
+	rowsizes = malloc(numsubsectors * sizeof(int));
+	if(!rows || !rowsizes) I_Error("R_LoadPVS: out of memory");
+	nextleaf = 0;
+	overflows = 0;
+
+	numthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(numthreads < 1) numthreads = 1;
+	if(numthreads > PVS_MAXTHREADS) numthreads = PVS_MAXTHREADS;
+
+	// The flow recurses once per subsector on the way
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 64 << 20);
+	for(i = 0; i < numthreads; i++) {
+		if(pthread_create(&threads[i], &attr, PVS_Worker, NULL))
+			I_Error("R_LoadPVS: couldn't start thread");
+	}
+	for(i = 0; i < numthreads; i++) pthread_join(threads[i], NULL);
+	pthread_attr_destroy(&attr);
+
+	pvssize = 0;
+	for(i = 0; i < numsubsectors; i++) pvssize += rowsizes[i];
+	pvsofs = malloc(numsubsectors * sizeof(int));
+	pvsdata = malloc(pvssize);
+	if(!pvsofs || !pvsdata) I_Error("R_LoadPVS: out of memory");
+
+	size = 0;
+	for(i = 0; i < numsubsectors; i++) {
+		pvsofs[i] = size;
+		memcpy(pvsdata + size, rows[i], rowsizes[i]);
+		size += rowsizes[i];
+		free(rows[i]);
+	}
+
+	printf("R_LoadPVS: %d subsectors, %d portals, %d bytes, %u ms\n",
+	    numsubsectors, numportals / 2, pvssize, (I_GetTimeUS() - start) / 1000);
+	if(overflows)
+		printf("R_LoadPVS: %d subsectors see everything\n", overflows);
+
+	free(rows);
+	free(rowsizes);
+	free(leafportals);
+	free(portals);
+	portals = NULL;
+	maxportals = 0;
+}
+
+//
+// PVS_CacheName
+// Names the cache file after a hash of the map geometry.
+//
+static void PVS_CacheName(int lumpnum, char *name) {
+	static int maplumps[] = {
+	    ML_LINEDEFS, ML_SIDEDEFS, ML_VERTEXES, ML_SEGS, ML_SSECTORS, ML_NODES};
+	uint64_t hash;
+	byte *data;
+	char *dir;
+	int i, j, p, length;
+
+	// FNV-1a
+	hash = 0xcbf29ce484222325ull;
+	for(i = 0; i < sizeof(maplumps) / sizeof(int); i++) {
+		length = W_LumpLength(lumpnum + maplumps[i]);
+		data = W_CacheLumpNum(lumpnum + maplumps[i], PU_CACHE);
+		for(j = 0; j < length; j++) {
+			hash ^= data[j];
+			hash *= 0x100000001b3ull;
+		}
+	}
+
+	dir = "pvs";
+	p = M_CheckParm("-pvsdir");
+	if(p && p < myargc - 1) dir = myargv[p + 1];
+	mkdir(dir, 0755);
+
+	sprintf(name, "%s/%016llx.pvs", dir, (unsigned long long) hash);
+}
+
+static boolean PVS_ReadCache(char *name) {
+	FILE *f;
+	char magic[4];
+	int header[4];
+	boolean ok;
+	int i;
+
+	f = fopen(name, "rb");
+	if(!f) return false;
+
+	ok = fread(magic, 4, 1, f) == 1 && !memcmp(magic, "DPVS", 4) &&
+	     fread(header, sizeof(header), 1, f) == 1 &&
+	     header[0] == PVS_VERSION && header[1] == numsubsectors &&
+	     header[2] == numnodes && header[3] > 0;
+
+	if(ok) {
+		pvssize = header[3];
+		pvsofs = malloc(numsubsectors * sizeof(int));
+		pvsdata = malloc(pvssize);
+		if(!pvsofs || !pvsdata) I_Error("R_LoadPVS: out of memory");
+
+		ok = fread(pvsofs, sizeof(int), numsubsectors, f) == numsubsectors &&
+		     fread(pvsdata, pvssize, 1, f) == 1;
+	}
+
+	fclose(f);
+	if(!ok) return false;
+
+	// Every row has to unpack without leaving pvsdata
+	for(i = 0; i < numsubsectors; i++) {
+		if(pvsofs[i] < 0 || pvsofs[i] >= pvssize ||
+		    !PVS_DecompressRow(
+		        pvsdata + pvsofs[i], pvsdata + pvssize, pvsrow)) {
+			printf("R_LoadPVS: ignoring broken %s\n", name);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void PVS_WriteCache(char *name) {
+	char tempname[1040];
+	FILE *f;
+	int header[4];
+	int ok, handle;
+
+	header[0] = PVS_VERSION;
+	header[1] = numsubsectors;
+	header[2] = numnodes;
+	header[3] = pvssize;
+
+	// Written under another name first,
+	//  so no one ever reads half a file.
+	snprintf(tempname, sizeof(tempname), "%s.XXXXXX", name);
+	handle = mkstemp(tempname);
+	f = handle == -1 ? NULL : fdopen(handle, "wb");
+	if(!f) {
+		printf("R_LoadPVS: couldn't write %s\n", tempname);
+		return;
+	}
+
+	ok = fwrite("DPVS", 4, 1, f) == 1;
+	ok &= fwrite(header, sizeof(header), 1, f) == 1;
+	ok &= fwrite(pvsofs, sizeof(int), numsubsectors, f) == numsubsectors;
+	ok &= fwrite(pvsdata, pvssize, 1, f) == 1;
+	ok &= fclose(f) == 0;
+	if(!ok || rename(tempname, name)) {
+		printf("R_LoadPVS: couldn't write %s\n", name);
+		remove(tempname);
+	}
+}
+
+//
+// PVS_FreeLevel
+//
+static void PVS_FreeLevel(void) {
+	free(pvsdata);
+	free(pvsofs);
+	free(pvsrow);
+	free(pvsnodes);
+	pvsdata = NULL;
+	pvsofs = NULL;
+	pvsrow = NULL;
+	pvsnodes = NULL;
+}
+
+//
+// PVS_Load
+// Reads or builds the PVS of the map that is loaded.
+//
+static void PVS_Load(int lumpnum) {
+	char name[1024];
+
+	PVS_FreeLevel();
+
+	// Nothing to skip on a single subsector map
+	if(!numnodes) return;
+
+	rowbytes = (numsubsectors + 7) >> 3;
+	pvsrow = malloc(rowbytes);
+	pvsnodes = malloc(numnodes);
+	if(!pvsrow || !pvsnodes) I_Error("R_LoadPVS: out of memory");
+	pvsleaf = -1;
+
+	PVS_CacheName(lumpnum, name);
+	if(PVS_ReadCache(name)) return;
+
+	free(pvsdata);
+	free(pvsofs);
+	pvsdata = NULL;
+	pvsofs = NULL;
+	PVS_Build();
+	PVS_WriteCache(name);
+}
+
+//
+// R_LoadPVS
+//
+void R_LoadPVS(int lumpnum) {
+	if(!M_CheckParm("-pvs")) return;
+
+	PVS_Load(lumpnum);
+}
+
+//
+// PVS_MarkNodes
+// Returns true if any subsector below bspnum is visible.
+//
+static boolean PVS_MarkNodes(int bspnum) {
+	node_t *node;
+	boolean front, back;
+
+	if(bspnum & NF_SUBSECTOR) {
+		bspnum &= ~NF_SUBSECTOR;
+		return (pvsrow[bspnum >> 3] >> (bspnum & 7)) & 1;
+	}
+
+	node = &nodes[bspnum];
+	front = PVS_MarkNodes(node->children[0]);
+	back = PVS_MarkNodes(node->children[1]);
+	pvsnodes[bspnum] = front || back;
+
+	return pvsnodes[bspnum];
+}
+
+//
+// R_SetupPVS
+//
+void R_SetupPVS(void) {
+	int leaf;
+
+	if(!pvsdata) return;
+
+	leaf = R_PointInSubsector(viewx, viewy) - subsectors;
+	if(leaf == pvsleaf) return;
+	pvsleaf = leaf;
+
+	PVS_DecompressRow(pvsdata + pvsofs[leaf], pvsdata + pvssize, pvsrow);
+	PVS_MarkNodes(numnodes - 1);
+}
+
+//
+// R_BuildAllPVS
+//
+void R_BuildAllPVS(void) {
+	int i;
+	char name[9];
+
+	for(i = 0; i + ML_NODES < numlumps; i++) {
+		if(strncasecmp(lumpinfo[i + ML_THINGS].name, "THINGS", 8) ||
+		    strncasecmp(lumpinfo[i + ML_NODES].name, "NODES", 8))
+			continue;
+
+		memcpy(name, lumpinfo[i].name, 8);
+		name[8] = 0;
+		printf("R_BuildAllPVS: %s\n", name);
+
+		Z_FreeTags(PU_LEVEL, PU_PURGELEVEL - 1);
+		P_SetupGeometry(i);
+		PVS_Load(i);
+	}
+
+	PVS_FreeLevel();
+}
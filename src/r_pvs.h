@@ -0,0 +1,47 @@
+//-----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 by Fabillotic
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+// DESCRIPTION:
+//	Potentially visible set of every subsector, -pvs.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __R_PVS__
+#define __R_PVS__
+
+#include "doomtype.h"
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+// One bit per subsector seen from the view subsector,
+//  NULL without -pvs.
+extern byte *pvsrow;
+
+// Nonzero for nodes with a visible subsector below them.
+extern byte *pvsnodes;
+
+// Loads the PVS of the map at lumpnum from the cache,
+//  or builds and caches it. Does nothing without -pvs.
+void R_LoadPVS(int lumpnum);
+
+// Picks the row of the view subsector, once per frame.
+void R_SetupPVS(void);
+
+// -buildpvs: caches the PVS of every map in the loaded WADs.
+void R_BuildAllPVS(void);
+
+#endif
@@ -314,8 +314,7 @@ void R_StoreWallRange(int start, int stop) {
 	fixed_t vtop;
 	int lightnum;
 
-	// don't overflow and crash
-	if(ds_p == &drawsegs[MAXDRAWSEGS]) return;
+	if(ds_p == drawsegs + maxdrawsegs) R_GrowDrawSegs();
 
 #ifdef RANGECHECK
 	if(start >= viewwidth || start > stop)
@@ -509,8 +508,8 @@ void R_StoreWallRange(int start, int stop) {
 		if(sidedef->midtexture) {
 			// masked midtexture
 			maskedtexture = true;
-			ds_p->maskedtexturecol = maskedtexturecol = lastopening - rw_x;
-			lastopening += rw_stopx - rw_x;
+			maskedtexturecol = R_AllocOpenings(rw_stopx - rw_x) - rw_x;
+			ds_p->maskedtexturecol = maskedtexturecol;
 		}
 	}
 
@@ -599,16 +598,16 @@ void R_StoreWallRange(int start, int stop) {
 
 	// save sprite clipping info
 	if(((ds_p->silhouette & SIL_TOP) || maskedtexture) && !ds_p->sprtopclip) {
-		memcpy(lastopening, ceilingclip + start, 2 * (rw_stopx - start));
-		ds_p->sprtopclip = lastopening - start;
-		lastopening += rw_stopx - start;
+		ds_p->sprtopclip = R_AllocOpenings(rw_stopx - start) - start;
+		memcpy(ds_p->sprtopclip + start, ceilingclip + start,
+		    2 * (rw_stopx - start));
 	}
 
 	if(((ds_p->silhouette & SIL_BOTTOM) || maskedtexture) &&
 	    !ds_p->sprbottomclip) {
-		memcpy(lastopening, floorclip + start, 2 * (rw_stopx - start));
-		ds_p->sprbottomclip = lastopening - start;
-		lastopening += rw_stopx - start;
+		ds_p->sprbottomclip = R_AllocOpenings(rw_stopx - start) - start;
+		memcpy(ds_p->sprbottomclip + start, floorclip + start,
+		    2 * (rw_stopx - start));
 	}
 
 	if(maskedtexture && !(ds_p->silhouette & SIL_TOP)) {
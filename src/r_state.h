@@ -36,6 +36,7 @@
 
 // needed for texture pegging
 extern fixed_t *textureheight;
+extern int numtextures;
 
 // needed for pre rendering (fracs)
 extern fixed_t *spritewidth;
@@ -50,6 +51,7 @@ extern int scaledviewwidth;
 extern int viewheight;
 
 extern int firstflat;
+extern int numflats;
 
 // for global animation
 extern int *flattranslation;
@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "doomdef.h"
 #include "m_swap.h"
@@ -245,10 +246,17 @@ void R_InitSpriteDefs(char **namelist) {
 //
 // GAME FUNCTIONS
 //
-vissprite_t vissprites[MAXVISSPRITES];
+// Grows by doubling, the sprites are only ever
+//  pointed at after the last one is made.
+vissprite_t *vissprites;
 vissprite_t *vissprite_p;
+static int maxvissprites;
 int newvissprite;
 
+int numvissprites;
+int peakvissprites;
+unsigned vsprsorttime;
+
 //
 // R_InitSprites
 // Called at program start.
@@ -274,10 +282,16 @@ void R_ClearSprites(void) {
 //
 // R_NewVisSprite
 //
-vissprite_t overflowsprite;
-
 vissprite_t *R_NewVisSprite(void) {
-	if(vissprite_p == &vissprites[MAXVISSPRITES]) return &overflowsprite;
+	int count;
+
+	count = vissprite_p - vissprites;
+	if(count == maxvissprites) {
+		maxvissprites = maxvissprites ? maxvissprites * 2 : 128;
+		vissprites = realloc(vissprites, maxvissprites * sizeof(vissprite_t));
+		if(!vissprites) I_Error("R_NewVisSprite: no more vissprites");
+		vissprite_p = vissprites + count;
+	}
 
 	vissprite_p++;
 	return vissprite_p - 1;
@@ -348,7 +362,7 @@ void R_DrawVisSprite(vissprite_t *vis, int x1, int x2) {
 		colfunc = fuzzcolfunc;
 	}
 	else if(vis->mobjflags & MF_TRANSLATION) {
-		colfunc = R_DrawTranslatedColumn;
+		colfunc = transcolfunc;
 		dc_translation =
 		    translationtables - 256 +
 		    ((vis->mobjflags & MF_TRANSLATION) >> (MF_TRANSSHIFT - 8));
@@ -663,51 +677,186 @@ void R_DrawPlayerSprites(void) {
 
 //
 // R_SortVisSprites
+// Stable sort on scale, sprites with the same scale stay in
+//  the order they were made, just like the old selection sort
+//  left them. A few sprites get an insertion sort, more a
+//  radix sort, 8 bits of the scale per pass.
 //
 vissprite_t vsprsortedhead;
 
+static vissprite_t **vsprsorted;
+static vissprite_t **vsprtemp;
+static int maxvsprsorted;
+
+#define SORTKEY(vis) ((unsigned) (vis)->scale ^ 0x80000000u)
+
+static void R_RadixSortVisSprites(int count) {
+	int i, shift;
+	int counts[256];
+	int start;
+	int sum;
+	vissprite_t **swap;
+
+	for(shift = 0; shift < 32; shift += 8) {
+		memset(counts, 0, sizeof(counts));
+		for(i = 0; i < count; i++)
+			counts[(SORTKEY(vsprsorted[i]) >> shift) & 0xff]++;
+
+		// all in one bucket, nothing to do this pass
+		if(counts[(SORTKEY(vsprsorted[0]) >> shift) & 0xff] == count)
+			continue;
+
+		sum = 0;
+		for(i = 0; i < 256; i++) {
+			start = sum;
+			sum += counts[i];
+			counts[i] = start;
+		}
+
+		for(i = 0; i < count; i++) {
+			vsprtemp[counts[(SORTKEY(vsprsorted[i]) >> shift) & 0xff]++] =
+			    vsprsorted[i];
+		}
+
+		swap = vsprsorted;
+		vsprsorted = vsprtemp;
+		vsprtemp = swap;
+	}
+}
+
 void R_SortVisSprites(void) {
-	int i;
+	int i, j;
 	int count;
+	unsigned start;
 	vissprite_t *ds;
-	vissprite_t *best;
-	vissprite_t unsorted;
-	fixed_t bestscale;
+
+	start = I_GetTimeUS();
 
 	count = vissprite_p - vissprites;
 
-	unsorted.next = unsorted.prev = &unsorted;
+	numvissprites = count;
+	if(count > peakvissprites) {
+		peakvissprites = count;
+		if(devparm) printf("R_SortVisSprites: %i vissprites\n", count);
+	}
 
-	if(!count) return;
+	vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
 
-	for(ds = vissprites; ds < vissprite_p; ds++) {
-		ds->next = ds + 1;
-		ds->prev = ds - 1;
+	if(!count) {
+		vsprsorttime = I_GetTimeUS() - start;
+		return;
 	}
 
-	vissprites[0].prev = &unsorted;
-	unsorted.next = &vissprites[0];
-	(vissprite_p - 1)->next = &unsorted;
-	unsorted.prev = vissprite_p - 1;
+	if(count > maxvsprsorted) {
+		maxvsprsorted = maxvissprites;
+		vsprsorted =
+		    realloc(vsprsorted, maxvsprsorted * sizeof(vissprite_t *));
+		vsprtemp = realloc(vsprtemp, maxvsprsorted * sizeof(vissprite_t *));
+		if(!vsprsorted || !vsprtemp)
+			I_Error("R_SortVisSprites: out of memory");
+	}
 
-	// pull the vissprites out by scale
-	// best = 0;		// shut up the compiler warning
-	vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
-	for(i = 0; i < count; i++) {
-		bestscale = MAXINT;
-		for(ds = unsorted.next; ds != &unsorted; ds = ds->next) {
-			if(ds->scale < bestscale) {
-				bestscale = ds->scale;
-				best = ds;
-			}
+	if(count < 32) {
+		for(i = 0; i < count; i++) {
+			ds = &vissprites[i];
+			for(j = i; j > 0 && vsprsorted[j - 1]->scale > ds->scale; j--)
+				vsprsorted[j] = vsprsorted[j - 1];
+			vsprsorted[j] = ds;
 		}
-		best->next->prev = best->prev;
-		best->prev->next = best->next;
-		best->next = &vsprsortedhead;
-		best->prev = vsprsortedhead.prev;
-		vsprsortedhead.prev->next = best;
-		vsprsortedhead.prev = best;
 	}
+	else {
+		for(i = 0; i < count; i++) vsprsorted[i] = &vissprites[i];
+		R_RadixSortVisSprites(count);
+	}
+
+	// link them up, smallest scale (farthest away) first
+	for(i = 0; i < count; i++) {
+		ds = vsprsorted[i];
+		ds->next = &vsprsortedhead;
+		ds->prev = vsprsortedhead.prev;
+		vsprsortedhead.prev->next = ds;
+		vsprsortedhead.prev = ds;
+	}
+
+	vsprsorttime = I_GetTimeUS() - start;
+}
+
+//
+// Drawsegs that can clip sprites (silhouette or masked),
+//  bucketed by screen column. Each bucket lists the drawsegs
+//  touching its columns by drawseg number, so a sprite only
+//  looks at the segs near it, in the order of the full scan.
+//
+#define DSBUCKETSHIFT 5
+#define DSBUCKETS ((SCREENWIDTH >> DSBUCKETSHIFT) + 1)
+
+static int dsbucketstart[DSBUCKETS + 1];
+static int *dsbuckets;
+static int maxdsbuckets;
+
+//
+// R_BuildDrawSegIndex
+// Once per frame, after the BSP walk.
+//
+static void R_BuildDrawSegIndex(void) {
+	drawseg_t *ds;
+	int fill[DSBUCKETS];
+	int b;
+	int total;
+
+	memset(fill, 0, sizeof(fill));
+	for(ds = drawsegs; ds < ds_p; ds++) {
+		if(!ds->silhouette && !ds->maskedtexturecol) continue;
+
+		for(b = ds->x1 >> DSBUCKETSHIFT; b <= ds->x2 >> DSBUCKETSHIFT; b++)
+			fill[b]++;
+	}
+
+	total = 0;
+	for(b = 0; b < DSBUCKETS; b++) {
+		dsbucketstart[b] = total;
+		total += fill[b];
+		fill[b] = dsbucketstart[b];
+	}
+	dsbucketstart[DSBUCKETS] = total;
+
+	if(total > maxdsbuckets) {
+		maxdsbuckets = total * 2;
+		dsbuckets = realloc(dsbuckets, maxdsbuckets * sizeof(int));
+		if(!dsbuckets) I_Error("R_BuildDrawSegIndex: out of memory");
+	}
+
+	for(ds = drawsegs; ds < ds_p; ds++) {
+		if(!ds->silhouette && !ds->maskedtexturecol) continue;
+
+		for(b = ds->x1 >> DSBUCKETSHIFT; b <= ds->x2 >> DSBUCKETSHIFT; b++)
+			dsbuckets[fill[b]++] = ds - drawsegs;
+	}
+}
+
+//
+// R_NextDrawSeg
+// Merges the buckets b1 to b2 from the back, every drawseg
+//  only once. heads holds the next entry of each bucket.
+//
+static drawseg_t *R_NextDrawSeg(int *heads, int b1, int b2) {
+	int b;
+	int best;
+
+	best = -1;
+	for(b = b1; b <= b2; b++) {
+		if(heads[b] >= dsbucketstart[b] && dsbuckets[heads[b]] > best)
+			best = dsbuckets[heads[b]];
+	}
+
+	if(best < 0) return NULL;
+
+	for(b = b1; b <= b2; b++) {
+		if(heads[b] >= dsbucketstart[b] && dsbuckets[heads[b]] == best)
+			heads[b]--;
+	}
+
+	return drawsegs + best;
 }
 
 //
@@ -717,6 +866,9 @@ void R_DrawSprite(vissprite_t *spr) {
 	drawseg_t *ds;
 	short clipbot[SCREENWIDTH];
 	short cliptop[SCREENWIDTH];
+	int heads[DSBUCKETS];
+	int b1;
+	int b2;
 	int x;
 	int r1;
 	int r2;
@@ -726,10 +878,15 @@ void R_DrawSprite(vissprite_t *spr) {
 
 	for(x = spr->x1; x <= spr->x2; x++) clipbot[x] = cliptop[x] = -2;
 
+	b1 = spr->x1 >> DSBUCKETSHIFT;
+	b2 = spr->x2 >> DSBUCKETSHIFT;
+	for(x = b1; x <= b2; x++) heads[x] = dsbucketstart[x + 1] - 1;
+
 	// Scan drawsegs from end to start for obscuring segs.
 	// The first drawseg that has a greater scale
 	//  is the clip seg.
-	for(ds = ds_p - 1; ds >= drawsegs; ds--) {
+	for(ds = R_NextDrawSeg(heads, b1, b2); ds;
+	    ds = R_NextDrawSeg(heads, b1, b2)) {
 		// determine if the drawseg obscures the sprite
 		if(ds->x1 > spr->x2 || ds->x2 < spr->x1 ||
 		    (!ds->silhouette && !ds->maskedtexturecol)) {
@@ -808,6 +965,8 @@ void R_DrawMasked(void) {
 	R_SortVisSprites();
 
 	if(vissprite_p > vissprites) {
+		R_BuildDrawSegIndex();
+
 		// draw all vissprites back to front
 		for(spr = vsprsortedhead.next; spr != &vsprsortedhead;
 		    spr = spr->next) {
@@ -25,12 +25,16 @@
 #pragma interface
 #endif
 
-#define MAXVISSPRITES 128
-
-extern vissprite_t vissprites[MAXVISSPRITES];
+extern vissprite_t *vissprites;
 extern vissprite_t *vissprite_p;
 extern vissprite_t vsprsortedhead;
 
+// Sprites this frame, the most in any frame so far,
+//  and the microseconds R_SortVisSprites took this frame.
+extern int numvissprites;
+extern int peakvissprites;
+extern unsigned vsprsorttime;
+
 // Constant arrays used for psprite clipping
 //  and initializing clipping.
 extern short negonearray[SCREENWIDTH];
@@ -0,0 +1,295 @@
+//-----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 by Fabillotic
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+// DESCRIPTION:
+//	Multithreaded column and span drawing.
+//	With -rthreads N the BSP walk, clipping and visplane building
+//	 stay on the main thread, exactly as before. Every call to
+//	 colfunc / spanfunc is queued instead, and at the end of the
+//	 frame N workers replay the queue, each one only drawing into
+//	 its own strip of screen columns.
+//	Everything a drawer reads or writes belongs to one column
+//	 (or, for spans, is clipped to the strip without changing the
+//	 stepping), so the frame comes out bit for bit the same.
+//
+//-----------------------------------------------------------------------------
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "r_local.h"
+#include "r_thread.h"
+#include "z_zone.h"
+
+#define MAXRTHREADS 16
+
+typedef struct {
+	void (*func)(void);
+	boolean span;
+
+	// Columns: dc_*
+	int x;
+	int yl;
+	int yh;
+	int fuzzpos;
+	fixed_t iscale;
+	fixed_t texturemid;
+	byte *translation;
+
+	// Spans: ds_*
+	int y;
+	int x1;
+	int x2;
+	fixed_t xfrac;
+	fixed_t yfrac;
+	fixed_t xstep;
+	fixed_t ystep;
+
+	lighttable_t *colormap;
+	byte *source;
+} drawcmd_t;
+
+int rthreads = 1;
+
+static drawcmd_t *queue;
+static int queuesize;
+static int queuelen;
+
+// The drawers picked by R_ExecuteSetViewSize
+static void (*drawcolumn)(void);
+static void (*drawfuzz)(void);
+static void (*drawtrans)(void);
+static void (*drawspan)(void);
+
+// Worker i draws screen columns [strips[i], strips[i + 1])
+static int strips[MAXRTHREADS + 1];
+
+static pthread_t workers[MAXRTHREADS];
+static pthread_mutex_t draw_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t draw_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int generation;
+static int busy;
+
+static drawcmd_t *new_cmd(void (*func)(void)) {
+	drawcmd_t *cmd;
+
+	if(queuelen == queuesize) {
+		queuesize = queuesize ? queuesize * 2 : 4096;
+		queue = realloc(queue, queuesize * sizeof(drawcmd_t));
+		if(!queue) I_Error("R_QueueDrawers: out of memory");
+	}
+
+	cmd = &queue[queuelen++];
+	cmd->func = func;
+	cmd->span = false;
+	return cmd;
+}
+
+static drawcmd_t *new_column(void (*func)(void)) {
+	drawcmd_t *cmd;
+
+	cmd = new_cmd(func);
+	cmd->x = dc_x;
+	cmd->yl = dc_yl;
+	cmd->yh = dc_yh;
+	cmd->iscale = dc_iscale;
+	cmd->texturemid = dc_texturemid;
+	cmd->translation = dc_translation;
+	cmd->colormap = dc_colormap;
+	cmd->source = dc_source;
+	return cmd;
+}
+
+static void queue_column(void) {
+	if(dc_yh < dc_yl) return;
+
+	new_column(drawcolumn);
+}
+
+static void queue_fuzz(void) {
+	drawcmd_t *cmd;
+
+	// Leave dc_yl / dc_yh behind like R_DrawFuzzColumn does
+	if(!dc_yl) dc_yl = 1;
+	if(dc_yh == viewheight - 1) dc_yh = viewheight - 2;
+
+	if(dc_yh < dc_yl) return;
+
+	// Walk the fuzz table here, the workers
+	//  start every column where it left off.
+	cmd = new_column(drawfuzz);
+	cmd->fuzzpos = fuzzpos;
+	fuzzpos = (fuzzpos + dc_yh - dc_yl + 1) % FUZZTABLE;
+}
+
+static void queue_trans(void) {
+	if(dc_yh < dc_yl) return;
+
+	new_column(drawtrans);
+}
+
+static void queue_span(void) {
+	drawcmd_t *cmd;
+
+	cmd = new_cmd(drawspan);
+	cmd->span = true;
+	cmd->y = ds_y;
+	cmd->x1 = ds_x1;
+	cmd->x2 = ds_x2;
+	cmd->xfrac = ds_xfrac;
+	cmd->yfrac = ds_yfrac;
+	cmd->xstep = ds_xstep;
+	cmd->ystep = ds_ystep;
+	cmd->colormap = ds_colormap;
+	cmd->source = ds_source;
+}
+
+static void draw_strip(int strip) {
+	drawcmd_t *cmd, *end;
+	int p1, p2;
+	int x1, x2;
+
+	p1 = strips[strip];
+	p2 = strips[strip + 1];
+
+	end = queue + queuelen;
+	for(cmd = queue; cmd < end; cmd++) {
+		if(cmd->span) {
+			x1 = p1;
+			x2 = p2 - 1;
+			if(x1 < cmd->x1) x1 = cmd->x1;
+			if(x2 > cmd->x2) x2 = cmd->x2;
+			if(x1 > x2) continue;
+
+			ds_y = cmd->y;
+			ds_x1 = x1;
+			ds_x2 = x2;
+			ds_xstep = cmd->xstep;
+			ds_ystep = cmd->ystep;
+			ds_colormap = cmd->colormap;
+			ds_source = cmd->source;
+
+			// Same as stepping there one pixel at a time
+			ds_xfrac = cmd->xfrac + (unsigned) (x1 - cmd->x1) * cmd->xstep;
+			ds_yfrac = cmd->yfrac + (unsigned) (x1 - cmd->x1) * cmd->ystep;
+		}
+		else {
+			if(cmd->x < p1 || cmd->x >= p2) continue;
+
+			dc_x = cmd->x;
+			dc_yl = cmd->yl;
+			dc_yh = cmd->yh;
+			dc_iscale = cmd->iscale;
+			dc_texturemid = cmd->texturemid;
+			dc_translation = cmd->translation;
+			dc_colormap = cmd->colormap;
+			dc_source = cmd->source;
+			fuzzpos = cmd->fuzzpos;
+		}
+
+		cmd->func();
+	}
+}
+
+static void *draw_worker(void *arg) {
+	int strip;
+	int seen;
+
+	strip = (intptr_t) arg;
+	seen = 0;
+
+	for(;;) {
+		pthread_mutex_lock(&draw_mutex);
+		while(generation == seen) pthread_cond_wait(&draw_cond, &draw_mutex);
+		seen = generation;
+		pthread_mutex_unlock(&draw_mutex);
+
+		draw_strip(strip);
+
+		pthread_mutex_lock(&draw_mutex);
+		if(!--busy) pthread_cond_signal(&done_cond);
+		pthread_mutex_unlock(&draw_mutex);
+	}
+
+	return NULL;
+}
+
+void R_InitThreads(void) {
+	int p, i;
+
+	p = M_CheckParm("-rthreads");
+	if(p && p < myargc - 1) rthreads = atoi(myargv[p + 1]);
+
+	if(rthreads < 1) rthreads = 1;
+	if(rthreads > MAXRTHREADS) rthreads = MAXRTHREADS;
+	if(rthreads == 1) return;
+
+	for(i = 0; i < rthreads; i++) {
+		if(pthread_create(&workers[i], NULL, draw_worker,
+		    (void *) (intptr_t) i))
+			I_Error("R_InitThreads: couldn't start drawing thread");
+	}
+
+	// Queued columns point into cached lumps and composites,
+	//  draw them before any of those can be thrown out.
+	purgefunc = R_FlushDraws;
+
+	printf("\nR_InitThreads: %d drawing threads", rthreads);
+}
+
+void R_QueueDrawers(void) {
+	int i;
+
+	// The low detail drawers write outside of their columns,
+	//  R_DrawSpanLow even runs past the end of the span.
+	//  Those stay single threaded.
+	if(rthreads == 1 || detailshift) return;
+
+	drawcolumn = basecolfunc;
+	drawfuzz = fuzzcolfunc;
+	drawtrans = transcolfunc;
+	drawspan = spanfunc;
+
+	colfunc = basecolfunc = queue_column;
+	fuzzcolfunc = queue_fuzz;
+	transcolfunc = queue_trans;
+	spanfunc = queue_span;
+
+	// Strip edges on multiples of 8 pixels keep the workers
+	//  mostly out of each other's cache lines.
+	for(i = 0; i < rthreads; i++)
+		strips[i] = (scaledviewwidth * i / rthreads) & ~7;
+	strips[rthreads] = scaledviewwidth;
+}
+
+void R_FlushDraws(void) {
+	if(!queuelen) return;
+
+	pthread_mutex_lock(&draw_mutex);
+	busy = rthreads;
+	generation++;
+	pthread_cond_broadcast(&draw_cond);
+	while(busy) pthread_cond_wait(&done_cond, &draw_mutex);
+	pthread_mutex_unlock(&draw_mutex);
+
+	queuelen = 0;
+}
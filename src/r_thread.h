@@ -0,0 +1,41 @@
+//-----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 by Fabillotic
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+// DESCRIPTION:
+//	Multithreaded column and span drawing, -rthreads N.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __R_THREAD__
+#define __R_THREAD__
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+// Number of drawing threads, 1 draws directly.
+extern int rthreads;
+
+// Reads -rthreads and starts the workers.
+void R_InitThreads(void);
+
+// Called whenever the view size changes, after the drawers
+//  are picked. Puts the queueing drawers in their place.
+void R_QueueDrawers(void);
+
+// Draws everything queued so far, split into column strips.
+void R_FlushDraws(void);
+
+#endif
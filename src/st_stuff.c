@@ -40,6 +40,7 @@
 #include "p_local.h"
 
 #include "am_map.h"
+#include "hu_stuff.h"
 #include "m_cheat.h"
 
 #include "s_sound.h"
@@ -425,6 +426,11 @@ unsigned char cheat_mypos_seq[] = {
     0xb2, 0x26, 0xb6, 0xba, 0x2a, 0xf6, 0xea, 0xff // idmypos
 };
 
+// zone memory overlay cheat
+unsigned char cheat_zone_seq[] = {
+    0xb2, 0x26, 0x7a, 0xf6, 0x76, 0xa6, 0xff // idzone
+};
+
 // Now what?
 cheatseq_t cheat_mus = {cheat_mus_seq, 0};
 cheatseq_t cheat_god = {cheat_god_seq, 0};
@@ -441,6 +447,7 @@ cheatseq_t cheat_powerup[7] = {{cheat_powerup_seq[0], 0},
 cheatseq_t cheat_choppers = {cheat_choppers_seq, 0};
 cheatseq_t cheat_clev = {cheat_clev_seq, 0};
 cheatseq_t cheat_mypos = {cheat_mypos_seq, 0};
+cheatseq_t cheat_zone = {cheat_zone_seq, 0};
 
 //
 extern char *mapnames[];
@@ -585,6 +592,10 @@ boolean ST_Responder(event_t *ev) {
 				    players[consoleplayer].mo->x, players[consoleplayer].mo->y);
 				plyr->message = buf;
 			}
+			// 'zone' for the zone memory overlay
+			else if(cht_CheckCheat(&cheat_zone, ev->data1)) {
+				showzonestats = !showzonestats;
+			}
 		}
 
 		// 'clev' change-level cheat
@@ -135,6 +135,8 @@ int usegamma;
 
 //
 // V_MarkRect
+// Everything drawn to screen 0 has to be marked, only the
+//  accumulated dirtybox is presented by I_FinishUpdate.
 //
 void V_MarkRect(int x, int y, int width, int height) {
 	M_AddToBox(dirtybox, x, y);
@@ -158,7 +160,7 @@ void V_CopyRect(int srcx, int srcy, int srcscrn, int width, int height,
 		I_Error("Bad V_CopyRect");
 	}
 #endif
-	V_MarkRect(destx, desty, width, height);
+	if(!destscrn) V_MarkRect(destx, desty, width, height);
 
 	src = screens[srcscrn] + SCREENWIDTH * srcy + srcx;
 	dest = screens[destscrn] + SCREENWIDTH * desty + destx;
@@ -346,7 +348,7 @@ void V_DrawBlock(int x, int y, int scrn, int width, int height, byte *src) {
 	}
 #endif
 
-	V_MarkRect(x, y, width, height);
+	if(!scrn) V_MarkRect(x, y, width, height);
 
 	dest = screens[scrn] + y * SCREENWIDTH + x;
 
@@ -392,4 +394,6 @@ void V_Init(void) {
 	base = I_AllocLow(SCREENWIDTH * SCREENHEIGHT * 4);
 
 	for(i = 0; i < 4; i++) screens[i] = base + i * SCREENWIDTH * SCREENHEIGHT;
+
+	M_ClearBox(dirtybox);
 }
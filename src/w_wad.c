@@ -25,6 +25,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #define O_BINARY 0
@@ -32,6 +33,7 @@
 
 #include "doomtype.h"
 #include "i_system.h"
+#include "m_argv.h"
 #include "m_swap.h"
 #include "z_zone.h"
 
@@ -50,6 +52,17 @@ int numlumps;
 
 void **lumpcache;
 
+void (*lumpwaitfunc)(int lump);
+
+// Open addressed index of the lump names, every slot holds
+//  the last lump with that name, or -1.
+static int *lumphash;
+static int lumphashsize;
+
+// -mmap: W_CacheLumpNum hands out lumps straight from the
+//  mapped files, they are never copied into the zone.
+static boolean mapwads;
+
 #define strcmpi strcasecmp
 
 void strupr(char *s) {
@@ -89,6 +102,69 @@ void ExtractFileBase(char *path, char *dest) {
 	}
 }
 
+//
+// W_HashName
+// Case insensitive, stops at the end of the name like strncasecmp.
+//
+unsigned W_HashName(char *name) {
+	unsigned hash;
+	int i;
+
+	hash = 2166136261u;
+	for(i = 0; i < 8 && name[i]; i++) {
+		hash ^= (byte) toupper((int) name[i]);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+//
+// W_HashLump
+// Puts lump in its slot, replacing an earlier lump of the same name.
+//
+static void W_HashLump(int lump) {
+	unsigned slot;
+	int *name;
+	int other;
+
+	name = (int *) lumpinfo[lump].name;
+	slot = W_HashName(lumpinfo[lump].name) & (lumphashsize - 1);
+
+	while((other = lumphash[slot]) != -1) {
+		if(*(int *) lumpinfo[other].name == name[0] &&
+		    *(int *) &lumpinfo[other].name[4] == name[1])
+			break;
+		slot = (slot + 1) & (lumphashsize - 1);
+	}
+
+	lumphash[slot] = lump;
+}
+
+//
+// W_HashLumps
+// Adds lumps [first, numlumps) to the index,
+//  rebuilding it when it gets more than half full.
+//
+static void W_HashLumps(int first) {
+	int i;
+
+	if(numlumps * 2 > lumphashsize) {
+		if(!lumphashsize) lumphashsize = 1024;
+		while(numlumps * 2 > lumphashsize) lumphashsize *= 2;
+
+		free(lumphash);
+		lumphash = malloc(lumphashsize * sizeof(*lumphash));
+		if(!lumphash) I_Error("Couldn't allocate lump hash");
+
+		memset(lumphash, -1, lumphashsize * sizeof(*lumphash));
+		first = 0;
+	}
+
+	// In order, so later files still override earlier ones
+	for(i = first; i < numlumps; i++) W_HashLump(i);
+}
+
 //
 // LUMP BASED ROUTINES.
 //
@@ -119,6 +195,8 @@ void W_AddFile(char *filename) {
 	filelump_t *fileinfo;
 	filelump_t singleinfo;
 	int storehandle;
+	int filesize;
+	byte *map;
 
 	// open the file and add to directory
 
@@ -137,6 +215,21 @@ void W_AddFile(char *filename) {
 	printf(" adding %s\n", filename);
 	startlump = numlumps;
 
+	// The reload file changes under us, it's always read.
+	map = NULL;
+	filesize = filelength(handle);
+	if(mapwads && !reloadname && filesize > 0) {
+		map = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, handle, 0);
+		if(map != MAP_FAILED && !Z_AddExternal(map, filesize)) {
+			munmap(map, filesize);
+			map = MAP_FAILED;
+		}
+		if(map == MAP_FAILED) {
+			printf(" couldn't map %s, reading it instead\n", filename);
+			map = NULL;
+		}
+	}
+
 	if(strcmpi(filename + strlen(filename) - 3, "wad")) {
 		// single lump file
 		fileinfo = &singleinfo;
@@ -161,9 +254,14 @@ void W_AddFile(char *filename) {
 		header.numlumps = LONG(header.numlumps);
 		header.infotableofs = LONG(header.infotableofs);
 		length = header.numlumps * sizeof(filelump_t);
-		fileinfo = alloca(length);
-		lseek(handle, header.infotableofs, SEEK_SET);
-		read(handle, fileinfo, length);
+		if(map && header.infotableofs >= 0 &&
+		    header.infotableofs <= filesize - length)
+			fileinfo = (filelump_t *) (map + header.infotableofs);
+		else {
+			fileinfo = alloca(length);
+			lseek(handle, header.infotableofs, SEEK_SET);
+			read(handle, fileinfo, length);
+		}
 		numlumps += header.numlumps;
 	}
 
@@ -178,11 +276,20 @@ void W_AddFile(char *filename) {
 
 	for(i = startlump; i < numlumps; i++, lump_p++, fileinfo++) {
 		lump_p->handle = storehandle;
+		lump_p->wadfile = filename;
 		lump_p->position = LONG(fileinfo->filepos);
 		lump_p->size = LONG(fileinfo->size);
 		strncpy(lump_p->name, fileinfo->name, 8);
+
+		// Empty lumps may sit right at the end of the mapping
+		lump_p->data = NULL;
+		if(map && lump_p->size > 0 && lump_p->position >= 0 &&
+		    lump_p->position <= filesize - lump_p->size)
+			lump_p->data = map + lump_p->position;
 	}
 
+	W_HashLumps(startlump);
+
 	if(reloadname) close(handle);
 }
 
@@ -242,6 +349,8 @@ void W_Reload(void) {
 void W_InitMultipleFiles(char **filenames) {
 	int size;
 
+	mapwads = M_CheckParm("-mmap");
+
 	// open all the files, load headers, and count lumps
 	numlumps = 0;
 
@@ -294,7 +403,8 @@ int W_CheckNumForName(char *name) {
 
 	int v1;
 	int v2;
-	lumpinfo_t *lump_p;
+	unsigned slot;
+	int lump;
 
 	// make the name into two integers for easy compares
 	strncpy(name8.s, name, 8);
@@ -308,13 +418,15 @@ int W_CheckNumForName(char *name) {
 	v1 = name8.x[0];
 	v2 = name8.x[1];
 
-	// scan backwards so patch lump files take precedence
-	lump_p = lumpinfo + numlumps;
+	// the index only keeps the last lump of every name,
+	//  so patch lump files take precedence
+	slot = W_HashName(name8.s) & (lumphashsize - 1);
 
-	while(lump_p-- != lumpinfo) {
-		if(*(int *) lump_p->name == v1 && *(int *) &lump_p->name[4] == v2) {
-			return lump_p - lumpinfo;
-		}
+	while((lump = lumphash[slot]) != -1) {
+		if(*(int *) lumpinfo[lump].name == v1 &&
+		    *(int *) &lumpinfo[lump].name[4] == v2)
+			return lump;
+		slot = (slot + 1) & (lumphashsize - 1);
 	}
 
 	// TFB. Not found.
@@ -359,6 +471,11 @@ void W_ReadLump(int lump, void *dest) {
 
 	l = lumpinfo + lump;
 
+	if(l->data) {
+		memcpy(dest, l->data, l->size);
+		return;
+	}
+
 	// ??? I_BeginRead ();
 
 	if(l->handle == -1) {
@@ -368,8 +485,9 @@ void W_ReadLump(int lump, void *dest) {
 	}
 	else handle = l->handle;
 
-	lseek(handle, l->position, SEEK_SET);
-	c = read(handle, dest, l->size);
+	// pread leaves the file position alone,
+	//  so the precache threads can read at the same time.
+	c = pread(handle, dest, l->size, l->position);
 
 	if(c < l->size)
 		I_Error("W_ReadLump: only read %i of %i on lump %i", c, l->size, lump);
@@ -384,10 +502,15 @@ void W_ReadLump(int lump, void *dest) {
 //
 void *W_CacheLumpNum(int lump, int tag) {
 	byte *ptr;
+	int oldtag;
 
 	if((unsigned) lump >= numlumps)
 		I_Error("W_CacheLumpNum: %i >= numlumps", lump);
 
+	// Mapped lumps are only ever read,
+	//  the tag doesn't mean anything for them.
+	if(lumpinfo[lump].data) return lumpinfo[lump].data;
+
 	if(!lumpcache[lump]) {
 		// read the lump in
 
@@ -397,7 +520,16 @@ void *W_CacheLumpNum(int lump, int tag) {
 	}
 	else {
 		// printf ("cache hit on lump %i\n",lump);
-		Z_ChangeTag(lumpcache[lump], tag);
+		if(lumpwaitfunc) lumpwaitfunc(lump);
+
+		// Lumps pinned for the level stay there unless the caller
+		//  needs them longer, the ones read ahead only until the
+		//  level claims them.
+		ptr = lumpcache[lump];
+		oldtag = ((memblock_t *) (ptr - sizeof(memblock_t)))->tag;
+		if(oldtag == PU_LEVEL && tag >= PU_LEVEL) return ptr;
+		if(oldtag != PU_PRELOAD || tag < PU_PURGELEVEL)
+			Z_ChangeTag(ptr, tag);
 	}
 
 	return lumpcache[lump];
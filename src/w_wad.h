@@ -51,15 +51,29 @@ typedef struct {
 	int handle;
 	int position;
 	int size;
+
+	// WAD file the lump comes from
+	char *wadfile;
+
+	// With -mmap, the lump inside the mapped file.
+	//  NULL for lumps that are read into the zone.
+	void *data;
 } lumpinfo_t;
 
 extern void **lumpcache;
+
+// If set, called before a cached lump is handed out,
+//  waits for lumps that are still being read.
+extern void (*lumpwaitfunc)(int lump);
 extern lumpinfo_t *lumpinfo;
 extern int numlumps;
 
 void W_InitMultipleFiles(char **filenames);
 void W_Reload(void);
 
+// Case insensitive hash of an up to 8 character name.
+unsigned W_HashName(char *name);
+
 int W_CheckNumForName(char *name);
 int W_GetNumForName(char *name);
 
@@ -30,6 +30,7 @@
 #include "w_wad.h"
 
 #include "g_game.h"
+#include "p_setup.h"
 
 #include "r_local.h"
 #include "s_sound.h"
@@ -1220,6 +1221,7 @@ void WI_Ticker(void) {
 	}
 
 	WI_checkForAccelerate();
+	R_PreloadTicker();
 
 	switch(state) {
 	case StatCount:
@@ -1489,6 +1491,9 @@ void WI_Start(wbstartstruct_t *wbstartstruct) {
 	WI_initVariables(wbstartstruct);
 	WI_loadData();
 
+	// wbs->next is 0 biased like wbs->epsd
+	P_PreloadLevel(wbs->epsd + 1, wbs->next + 1);
+
 	if(deathmatch) WI_initDeathmatchStats();
 	else if(netgame) WI_initNetgameStats();
 	else WI_initStats();
@@ -18,16 +18,29 @@
 //
 //-----------------------------------------------------------------------------
 
+#include <stdint.h>
+#include <stdlib.h>
+
 #include "z_zone.h"
 #include "doomdef.h"
+#include "doomstat.h"
 #include "i_system.h"
+#include "m_argv.h"
 
 //
 // ZONE MEMORY ALLOCATION
 //
-// There is never any space between memblocks,
+// The zone is made of regions mapped as they are needed.
+// There is never any space between the memblocks of a region,
 //  and there will never be two contiguous free memblocks.
-// The rover can be left pointing at a non-empty block.
+//
+// Free blocks are kept in lists by size: one list for every
+//  multiple of ZONEALIGN up to SMALLMAX, and one list for every
+//  power of two above that. A bitmap of the lists that aren't
+//  empty finds the smallest fitting one without a scan.
+// In use purgable blocks are kept in an LRU list instead. When no
+//  free block fits, the zone grows by another region up to the
+//  soft limit, past it they are thrown out first, oldest first.
 //
 // It is of no value to free a cachable block,
 //  because it will get overwritten automatically if needed.
@@ -35,77 +48,280 @@
 
 #define ZONEID 0x1d4a11
 
-typedef struct {
-	// total bytes malloced, including header
+#define ZONEALIGN 16
+
+// Blocks up to this size, header included, are "small"
+#define SMALLMAX 4096
+
+#define NUMSMALL (SMALLMAX / ZONEALIGN + 1)
+#define SMALLWORDS ((NUMSMALL + 31) / 32)
+#define NUMLARGE 32
+
+// The size of the fixed zone of old, the least that is mapped
+#define REGIONSIZE (6 * 1024 * 1024)
+
+// Default soft limit in MB, -zonelimit <MB>
+#define ZONELIMIT 64
+
+#define REGIONHEADER \
+	((sizeof(zoneregion_t) + ZONEALIGN - 1) & ~(ZONEALIGN - 1))
+
+typedef struct zoneregion_s {
+	// bytes mapped, including this header
 	int size;
 
-	// start / end cap for linked list
+	// start / end cap for the blocks in it
 	memblock_t blocklist;
 
-	memblock_t *rover;
+	struct zoneregion_s *next;
+} zoneregion_t;
+
+typedef struct {
+	// total bytes mapped, including headers
+	int size;
+
+	// newest first
+	zoneregion_t *regions;
+
+	// start / end cap for the purgable blocks,
+	//  most recently used first
+	memblock_t lru;
+
+	memblock_t *smallfree[NUMSMALL];
+	memblock_t *largefree[NUMLARGE];
+	unsigned smallmap[SMALLWORDS];
+	unsigned largemap;
 
+	int freebytes;
+	int purgablebytes;
 } memzone_t;
 
-memzone_t *mainzone;
+static memzone_t zone;
+memzone_t *mainzone = &zone;
+
+static int zonelimit;
+
+zonestats_t zonestats;
+
+zonetag_t zonetags[] = {{"static", PU_STATIC}, {"sound", PU_SOUND},
+    {"music", PU_MUSIC}, {"dave", PU_DAVE}, {"preload", PU_PRELOAD},
+    {"level", PU_LEVEL}, {"levspec", PU_LEVSPEC},
+    {"purgelevel", PU_PURGELEVEL}, {"cache", PU_CACHE}, {NULL, 0}};
+
+// -zonestats <file>, one line per tic
+static FILE *statsfile;
+
+// Bytes of objects in a pool slab
+#define SLABSIZE 16384
+
+// The pools that have slabs
+static zonepool_t *pools;
+
+void (*purgefunc)(void);
+
+// More than the MAXWADFILES files that can be added
+#define MAXEXTERNAL 32
+
+static byte *externalstart[MAXEXTERNAL];
+static byte *externalend[MAXEXTERNAL];
+static int numexternal;
+
+//
+// Z_LargeList
+// The list of large blocks of a size, by its highest bit.
+//
+static int Z_LargeList(int size) {
+	return 31 - __builtin_clz(size);
+}
+
+//
+// Z_LinkFree
+//
+static void Z_LinkFree(memblock_t *block) {
+	memblock_t **list;
+	int i;
+
+	if(block->size <= SMALLMAX) {
+		i = block->size / ZONEALIGN;
+		list = &mainzone->smallfree[i];
+		mainzone->smallmap[i >> 5] |= 1u << (i & 31);
+	}
+	else {
+		i = Z_LargeList(block->size);
+		list = &mainzone->largefree[i];
+		mainzone->largemap |= 1u << i;
+	}
+
+	block->listprev = NULL;
+	block->listnext = *list;
+	if(*list) (*list)->listprev = block;
+	*list = block;
+
+	mainzone->freebytes += block->size;
+}
 
 //
-// Z_ClearZone
+// Z_UnlinkFree
 //
-void Z_ClearZone(memzone_t *zone) {
+static void Z_UnlinkFree(memblock_t *block) {
+	int i;
+
+	if(block->listnext) block->listnext->listprev = block->listprev;
+
+	if(block->listprev) block->listprev->listnext = block->listnext;
+	else if(block->size <= SMALLMAX) {
+		i = block->size / ZONEALIGN;
+		mainzone->smallfree[i] = block->listnext;
+		if(!block->listnext) mainzone->smallmap[i >> 5] &= ~(1u << (i & 31));
+	}
+	else {
+		i = Z_LargeList(block->size);
+		mainzone->largefree[i] = block->listnext;
+		if(!block->listnext) mainzone->largemap &= ~(1u << i);
+	}
+
+	mainzone->freebytes -= block->size;
+}
+
+//
+// Z_LinkLRU
+// Puts a purgable block at the recently used end.
+//
+static void Z_LinkLRU(memblock_t *block) {
+	block->listprev = &mainzone->lru;
+	block->listnext = mainzone->lru.listnext;
+	block->listnext->listprev = block;
+	mainzone->lru.listnext = block;
+
+	mainzone->purgablebytes += block->size;
+}
+
+//
+// Z_UnlinkLRU
+//
+static void Z_UnlinkLRU(memblock_t *block) {
+	block->listprev->listnext = block->listnext;
+	block->listnext->listprev = block->listprev;
+
+	mainzone->purgablebytes -= block->size;
+}
+
+//
+// Z_FindFree
+// The free block to cut size bytes from, NULL if none is big enough.
+//
+static memblock_t *Z_FindFree(int size) {
 	memblock_t *block;
+	unsigned bits;
+	int i, word;
 
-	// set the entire zone to one free block
-	zone->blocklist.next = zone->blocklist.prev = block =
-	    (memblock_t *) ((byte *) zone + sizeof(memzone_t));
+	if(size <= SMALLMAX) {
+		// smallest small list that fits, every block in it does
+		i = size / ZONEALIGN;
+		word = i >> 5;
+		bits = mainzone->smallmap[word] & (~0u << (i & 31));
 
-	zone->blocklist.user = (void *) zone;
-	zone->blocklist.tag = PU_STATIC;
-	zone->rover = block;
+		for(;;) {
+			if(bits)
+				return mainzone->smallfree[(word << 5) + __builtin_ctz(bits)];
 
-	block->prev = block->next = &zone->blocklist;
+			if(++word == SMALLWORDS) break;
+			bits = mainzone->smallmap[word];
+		}
 
-	// NULL indicates a free block.
-	block->user = NULL;
+		if(!mainzone->largemap) return NULL;
+		return mainzone->largefree[__builtin_ctz(mainzone->largemap)];
+	}
+
+	// first fit among the blocks with the same highest bit
+	i = Z_LargeList(size);
+	for(block = mainzone->largefree[i]; block; block = block->listnext) {
+		if(block->size >= size) return block;
+	}
 
-	block->size = zone->size - sizeof(memzone_t);
+	// any larger one will do
+	bits = i < NUMLARGE - 1 ? mainzone->largemap & (~0u << (i + 1)) : 0;
+	if(!bits) return NULL;
+	return mainzone->largefree[__builtin_ctz(bits)];
 }
 
 //
-// Z_Init
+// Z_AddRegion
+// Maps a region with a free block of at least size bytes.
 //
-void Z_Init(void) {
+static boolean Z_AddRegion(int size) {
+	zoneregion_t *region;
 	memblock_t *block;
-	int size;
 
-	mainzone = (memzone_t *) I_ZoneBase(&size);
-	mainzone->size = size;
+	size += REGIONHEADER;
+	if(size < REGIONSIZE) size = REGIONSIZE;
 
-	// set the entire zone to one free block
-	mainzone->blocklist.next = mainzone->blocklist.prev = block =
-	    (memblock_t *) ((byte *) mainzone + sizeof(memzone_t));
+	region = (zoneregion_t *) I_ZoneRegion(&size);
+	if(!region) return false;
 
-	mainzone->blocklist.user = (void *) mainzone;
-	mainzone->blocklist.tag = PU_STATIC;
-	mainzone->rover = block;
+	region->size = size;
+	region->next = mainzone->regions;
+	mainzone->regions = region;
+	mainzone->size += size;
 
-	block->prev = block->next = &mainzone->blocklist;
+	block = (memblock_t *) ((byte *) region + REGIONHEADER);
+
+	region->blocklist.next = region->blocklist.prev = block;
+	region->blocklist.user = (void *) region;
+	region->blocklist.tag = PU_STATIC;
+
+	block->prev = block->next = &region->blocklist;
 
 	// NULL indicates a free block.
 	block->user = NULL;
+	block->tag = 0;
+	block->id = 0;
 
-	block->size = mainzone->size - sizeof(memzone_t);
+	// set the entire region to one free block
+	block->size = (size - REGIONHEADER) & ~(ZONEALIGN - 1);
+	Z_LinkFree(block);
+
+	return true;
 }
 
 //
-// Z_Free
+// Z_Init
 //
-void Z_Free(void *ptr) {
-	memblock_t *block;
-	memblock_t *other;
+void Z_Init(void) {
+	int p;
 
-	block = (memblock_t *) ((byte *) ptr - sizeof(memblock_t));
+	zonelimit = ZONELIMIT;
+	p = M_CheckParm("-zonelimit");
+	if(p && p < myargc - 1) zonelimit = atoi(myargv[p + 1]);
 
-	if(block->id != ZONEID) I_Error("Z_Free: freed a pointer without ZONEID");
+	if(zonelimit < 1) zonelimit = 1;
+	if(zonelimit > 1024) zonelimit = 1024;
+	zonelimit *= 1024 * 1024;
+
+	mainzone->lru.listnext = mainzone->lru.listprev = &mainzone->lru;
+
+	p = M_CheckParm("-zonestats");
+	if(p && p < myargc - 1) {
+		statsfile = fopen(myargv[p + 1], "w");
+		if(!statsfile) I_Error("Z_Init: couldn't open %s", myargv[p + 1]);
+
+		fprintf(statsfile, "tic,mapped,free,purgable,largest,fragmentation,"
+		                   "mallocs,frees,purges,purgedbytes");
+		for(p = 0; zonetags[p].name; p++)
+			fprintf(statsfile, ",%s,%s_blocks", zonetags[p].name,
+			    zonetags[p].name);
+		fprintf(statsfile, "\n");
+	}
+
+	if(!Z_AddRegion(0)) I_Error("Z_Init: couldn't map the zone");
+}
+
+//
+// Z_FreeBlock
+// Returns the free block that block ended up in.
+//
+static memblock_t *Z_FreeBlock(memblock_t *block) {
+	memblock_t *other;
 
 	if(block->user > (void **) 0x100) {
 		// smaller values are not pointers
@@ -115,6 +331,12 @@ void Z_Free(void *ptr) {
 		*block->user = 0;
 	}
 
+	if(block->tag >= PU_PURGELEVEL) Z_UnlinkLRU(block);
+
+	zonestats.tagbytes[block->tag] -= block->size;
+	zonestats.tagblocks[block->tag]--;
+	zonestats.frees++;
+
 	// mark as free
 	block->user = NULL;
 	block->tag = 0;
@@ -124,88 +346,85 @@ void Z_Free(void *ptr) {
 
 	if(!other->user) {
 		// merge with previous free block
+		Z_UnlinkFree(other);
 		other->size += block->size;
 		other->next = block->next;
 		other->next->prev = other;
 
-		if(block == mainzone->rover) mainzone->rover = other;
-
 		block = other;
 	}
 
 	other = block->next;
 	if(!other->user) {
 		// merge the next free block onto the end
+		Z_UnlinkFree(other);
 		block->size += other->size;
 		block->next = other->next;
 		block->next->prev = block;
-
-		if(other == mainzone->rover) mainzone->rover = block;
 	}
+
+	Z_LinkFree(block);
+	return block;
+}
+
+//
+// Z_Free
+//
+void Z_Free(void *ptr) {
+	memblock_t *block;
+
+	if(Z_IsExternal(ptr)) return;
+
+	block = (memblock_t *) ((byte *) ptr - sizeof(memblock_t));
+
+	if(block->id != ZONEID) I_Error("Z_Free: freed a pointer without ZONEID");
+
+	Z_FreeBlock(block);
 }
 
 //
 // Z_Malloc
 // You can pass a NULL user if the tag is < PU_PURGELEVEL.
 //
-#define MINFRAGMENT 64
+#define MINFRAGMENT (sizeof(memblock_t) + 32)
 
 void *Z_Malloc(int size, int tag, void *user) {
 	int extra;
-	memblock_t *start;
-	memblock_t *rover;
 	memblock_t *newblock;
 	memblock_t *base;
 
-	size = (size + 3) & ~3;
-
-	// scan through the block list,
-	// looking for the first free block
-	// of sufficient size,
-	// throwing out any purgable blocks along the way.
+	if(tag < 0 || tag >= NUMZONETAGS) I_Error("Z_Malloc: bad tag %i", tag);
 
 	// account for size of block header
 	size += sizeof(memblock_t);
 
-	// if there is a free block behind the rover,
-	//  back up over them
-	base = mainzone->rover;
+	// whole size classes only
+	size = (size + ZONEALIGN - 1) & ~(ZONEALIGN - 1);
 
-	if(!base->prev->user) base = base->prev;
+	while(!(base = Z_FindFree(size))) {
+		// grow below the soft limit, or when there is nothing to purge
+		if(mainzone->size < zonelimit ||
+		    mainzone->lru.listprev == &mainzone->lru) {
+			if(Z_AddRegion(size)) continue;
 
-	rover = base;
-	start = base->prev;
-
-	do {
-		if(rover == start) {
-			// scanned all the way around the list
-			I_Error("Z_Malloc: failed on allocation of %i bytes", size);
+			if(mainzone->lru.listprev == &mainzone->lru)
+				I_Error("Z_Malloc: failed on allocation of %i bytes", size);
 		}
 
-		if(rover->user) {
-			if(rover->tag < PU_PURGELEVEL) {
-				// hit a block that can't be purged,
-				//  so move base past it
-				base = rover = rover->next;
-			}
-			else {
-				// free the rover block (adding the size to base)
-
-				// the rover can be the base block
-				base = base->prev;
-				Z_Free((byte *) rover + sizeof(memblock_t));
-				base = base->next;
-				rover = base->next;
-			}
-		}
-		else rover = rover->next;
+		// throw out the least recently used purgable block
+		if(purgefunc) purgefunc();
+
+		zonestats.purges++;
+		zonestats.purgedbytes += mainzone->lru.listprev->size;
+		Z_FreeBlock(mainzone->lru.listprev);
 	}
-	while(base->user || base->size < size);
+
+	Z_UnlinkFree(base);
 
 	// found a block big enough
 	extra = base->size - size;
 
-	if(extra > MINFRAGMENT) {
+	if(extra >= MINFRAGMENT) {
 		// there will be a free fragment after the allocated block
 		newblock = (memblock_t *) ((byte *) base + size);
 		newblock->size = extra;
@@ -213,12 +432,15 @@ void *Z_Malloc(int size, int tag, void *user) {
 		// NULL indicates free block.
 		newblock->user = NULL;
 		newblock->tag = 0;
+		newblock->id = 0;
 		newblock->prev = base;
 		newblock->next = base->next;
 		newblock->next->prev = newblock;
 
 		base->next = newblock;
 		base->size = size;
+
+		Z_LinkFree(newblock);
 	}
 
 	if(user) {
@@ -235,8 +457,11 @@ void *Z_Malloc(int size, int tag, void *user) {
 	}
 	base->tag = tag;
 
-	// next allocation will start looking here
-	mainzone->rover = base->next;
+	if(tag >= PU_PURGELEVEL) Z_LinkLRU(base);
+
+	zonestats.tagbytes[tag] += base->size;
+	zonestats.tagblocks[tag]++;
+	zonestats.mallocs++;
 
 	base->id = ZONEID;
 
@@ -247,19 +472,124 @@ void *Z_Malloc(int size, int tag, void *user) {
 // Z_FreeTags
 //
 void Z_FreeTags(int lowtag, int hightag) {
+	zoneregion_t *region;
+	memblock_t *block;
+	memblock_t *next;
+	zonepool_t *pool;
+
+	for(region = mainzone->regions; region; region = region->next) {
+		for(block = region->blocklist.next; block != &region->blocklist;
+		    block = next) {
+			next = block->next;
+
+			// free block?
+			if(!block->user) continue;
+
+			// go on after whatever it was merged with
+			if(block->tag >= lowtag && block->tag <= hightag)
+				next = Z_FreeBlock(block)->next;
+		}
+	}
+
+	// their slabs are gone
+	for(pool = pools; pool; pool = pool->next) {
+		if(pool->tag >= lowtag && pool->tag <= hightag) pool->freelist = NULL;
+	}
+}
+
+//
+// Z_PoolAlloc
+// Every object is preceded by its pool, free ones
+//  start with the next free one.
+//
+void *Z_PoolAlloc(zonepool_t *pool) {
+	zonepool_t **item;
+	byte *slab;
+	void *ptr;
+	int stride;
+	int count;
+	int i;
+
+	if(!pool->freelist) {
+		if(!pool->linked) {
+			pool->next = pools;
+			pools = pool;
+			pool->linked = 1;
+		}
+
+		stride = (sizeof(zonepool_t *) + pool->size + 7) & ~7;
+		count = SLABSIZE / stride;
+		if(count < 1) count = 1;
+
+		slab = Z_Malloc(count * stride, pool->tag, NULL);
+
+		// backwards, so they are handed out in order
+		for(i = count - 1; i >= 0; i--) {
+			item = (zonepool_t **) (slab + i * stride);
+			*item = pool;
+			*(void **) (item + 1) = pool->freelist;
+			pool->freelist = item + 1;
+		}
+	}
+
+	ptr = pool->freelist;
+	pool->freelist = *(void **) ptr;
+	return ptr;
+}
+
+//
+// Z_PoolFree
+//
+void Z_PoolFree(void *ptr) {
+	zonepool_t *pool;
+
+	pool = ((zonepool_t **) ptr)[-1];
+	*(void **) ptr = pool->freelist;
+	pool->freelist = ptr;
+}
+
+//
+// Z_ReleaseRegions
+// Unmaps every region but the first that holds nothing
+//  but free and purgable blocks.
+//
+void Z_ReleaseRegions(void) {
+	zoneregion_t **link;
+	zoneregion_t *region;
 	memblock_t *block;
 	memblock_t *next;
 
-	for(block = mainzone->blocklist.next; block != &mainzone->blocklist;
-	    block = next) {
-		// get link before freeing
-		next = block->next;
+	link = &mainzone->regions;
+
+	while((region = *link)->next) {
+		for(block = region->blocklist.next; block != &region->blocklist;
+		    block = block->next) {
+			if(block->user && block->tag < PU_PURGELEVEL) break;
+		}
+
+		if(block != &region->blocklist) {
+			link = &region->next;
+			continue;
+		}
+
+		if(purgefunc) purgefunc();
 
-		// free block?
-		if(!block->user) continue;
+		for(block = region->blocklist.next; block != &region->blocklist;
+		    block = next) {
+			next = block->next;
+			if(!block->user) continue;
+
+			zonestats.purges++;
+			zonestats.purgedbytes += block->size;
+			next = Z_FreeBlock(block)->next;
+		}
 
-		if(block->tag >= lowtag && block->tag <= hightag)
-			Z_Free((byte *) block + sizeof(memblock_t));
+		// one free block is left
+		Z_UnlinkFree(region->blocklist.next);
+
+		*link = region->next;
+		mainzone->size -= region->size;
+		I_ReleaseZoneRegion((byte *) region, region->size);
 	}
 }
 
@@ -268,30 +598,35 @@ void Z_FreeTags(int lowtag, int hightag) {
 // Note: TFileDumpHeap( stdout ) ?
 //
 void Z_DumpHeap(int lowtag, int hightag) {
+	zoneregion_t *region;
 	memblock_t *block;
 
-	printf("zone size: %i  location: %p\n", mainzone->size, mainzone);
+	printf("zone size: %i  soft limit: %i\n", mainzone->size, zonelimit);
 
 	printf("tag range: %i to %i\n", lowtag, hightag);
 
-	for(block = mainzone->blocklist.next;; block = block->next) {
-		if(block->tag >= lowtag && block->tag <= hightag)
-			printf("block:%p    size:%7i    user:%p    tag:%3i\n", block,
-			    block->size, block->user, block->tag);
+	for(region = mainzone->regions; region; region = region->next) {
+		printf("region:%p    size:%7i\n", region, region->size);
 
-		if(block->next == &mainzone->blocklist) {
-			// all blocks have been hit
-			break;
-		}
+		for(block = region->blocklist.next;; block = block->next) {
+			if(block->tag >= lowtag && block->tag <= hightag)
+				printf("block:%p    size:%7i    user:%p    tag:%3i\n", block,
+				    block->size, block->user, block->tag);
 
-		if((byte *) block + block->size != (byte *) block->next)
-			printf("ERROR: block size does not touch the next block\n");
+			if(block->next == &region->blocklist) {
+				// all blocks have been hit
+				break;
+			}
 
-		if(block->next->prev != block)
-			printf("ERROR: next block doesn't have proper back link\n");
+			if((byte *) block + block->size != (byte *) block->next)
+				printf("ERROR: block size does not touch the next block\n");
 
-		if(!block->user && !block->next->user)
-			printf("ERROR: two consecutive free blocks\n");
+			if(block->next->prev != block)
+				printf("ERROR: next block doesn't have proper back link\n");
+
+			if(!block->user && !block->next->user)
+				printf("ERROR: two consecutive free blocks\n");
+		}
 	}
 }
 
@@ -299,27 +634,32 @@ void Z_DumpHeap(int lowtag, int hightag) {
 // Z_FileDumpHeap
 //
 void Z_FileDumpHeap(FILE *f) {
+	zoneregion_t *region;
 	memblock_t *block;
 
-	fprintf(f, "zone size: %i  location: %p\n", mainzone->size, mainzone);
+	fprintf(f, "zone size: %i  soft limit: %i\n", mainzone->size, zonelimit);
 
-	for(block = mainzone->blocklist.next;; block = block->next) {
-		fprintf(f, "block:%p    size:%7i    user:%p    tag:%3i\n", block,
-		    block->size, block->user, block->tag);
+	for(region = mainzone->regions; region; region = region->next) {
+		fprintf(f, "region:%p    size:%7i\n", region, region->size);
 
-		if(block->next == &mainzone->blocklist) {
-			// all blocks have been hit
-			break;
-		}
+		for(block = region->blocklist.next;; block = block->next) {
+			fprintf(f, "block:%p    size:%7i    user:%p    tag:%3i\n", block,
+			    block->size, block->user, block->tag);
+
+			if(block->next == &region->blocklist) {
+				// all blocks have been hit
+				break;
+			}
 
-		if((byte *) block + block->size != (byte *) block->next)
-			fprintf(f, "ERROR: block size does not touch the next block\n");
+			if((byte *) block + block->size != (byte *) block->next)
+				fprintf(f, "ERROR: block size does not touch the next block\n");
 
-		if(block->next->prev != block)
-			fprintf(f, "ERROR: next block doesn't have proper back link\n");
+			if(block->next->prev != block)
+				fprintf(f, "ERROR: next block doesn't have proper back link\n");
 
-		if(!block->user && !block->next->user)
-			fprintf(f, "ERROR: two consecutive free blocks\n");
+			if(!block->user && !block->next->user)
+				fprintf(f, "ERROR: two consecutive free blocks\n");
+		}
 	}
 }
 
@@ -327,23 +667,40 @@ void Z_FileDumpHeap(FILE *f) {
 // Z_CheckHeap
 //
 void Z_CheckHeap(void) {
+	zoneregion_t *region;
 	memblock_t *block;
+	int free, purgable;
 
-	for(block = mainzone->blocklist.next;; block = block->next) {
-		if(block->next == &mainzone->blocklist) {
-			// all blocks have been hit
-			break;
-		}
+	free = purgable = 0;
+
+	for(region = mainzone->regions; region; region = region->next) {
+		for(block = region->blocklist.next;; block = block->next) {
+			if(!block->user) free += block->size;
+			else if(block->tag >= PU_PURGELEVEL) purgable += block->size;
+
+			if(block->next == &region->blocklist) {
+				// all blocks have been hit
+				if((byte *) block + block->size > (byte *) region + region->size)
+					I_Error("Z_CheckHeap: block runs past its region\n");
+				break;
+			}
 
-		if((byte *) block + block->size != (byte *) block->next)
-			I_Error("Z_CheckHeap: block size does not touch the next block\n");
+			if((byte *) block + block->size != (byte *) block->next)
+				I_Error("Z_CheckHeap: block size does not touch the next block\n");
 
-		if(block->next->prev != block)
-			I_Error("Z_CheckHeap: next block doesn't have proper back link\n");
+			if(block->next->prev != block)
+				I_Error("Z_CheckHeap: next block doesn't have proper back link\n");
 
-		if(!block->user && !block->next->user)
-			I_Error("Z_CheckHeap: two consecutive free blocks\n");
+			if(!block->user && !block->next->user)
+				I_Error("Z_CheckHeap: two consecutive free blocks\n");
+		}
 	}
+
+	if(free != mainzone->freebytes)
+		I_Error("Z_CheckHeap: free lists don't match the blocks\n");
+
+	if(purgable != mainzone->purgablebytes)
+		I_Error("Z_CheckHeap: LRU list doesn't match the blocks\n");
 }
 
 //
@@ -360,21 +717,232 @@ void Z_ChangeTag2(void *ptr, int tag) {
 	if(tag >= PU_PURGELEVEL && (unsigned) block->user < 0x100)
 		I_Error("Z_ChangeTag: an owner is required for purgable blocks");
 
+	if(tag < 0 || tag >= NUMZONETAGS)
+		I_Error("Z_ChangeTag: bad tag %i", tag);
+
+	if(block->tag >= PU_PURGELEVEL) Z_UnlinkLRU(block);
+
+	zonestats.tagbytes[block->tag] -= block->size;
+	zonestats.tagblocks[block->tag]--;
+	zonestats.tagbytes[tag] += block->size;
+	zonestats.tagblocks[tag]++;
+
 	block->tag = tag;
+
+	// retagging a purgable block counts as using it
+	if(tag >= PU_PURGELEVEL) Z_LinkLRU(block);
+}
+
+//
+// Z_AddExternal
+// False if there is no room for another region.
+//
+int Z_AddExternal(void *start, int size) {
+	if(numexternal == MAXEXTERNAL) return 0;
+
+	externalstart[numexternal] = start;
+	externalend[numexternal] = (byte *) start + size;
+	numexternal++;
+	return 1;
+}
+
+//
+// Z_IsExternal
+//
+int Z_IsExternal(void *ptr) {
+	int i;
+
+	for(i = 0; i < numexternal; i++) {
+		if((byte *) ptr >= externalstart[i] && (byte *) ptr < externalend[i])
+			return 1;
+	}
+
+	return 0;
 }
 
 //
 // Z_FreeMemory
 //
 int Z_FreeMemory(void) {
-	memblock_t *block;
 	int free;
 
-	free = 0;
+	free = mainzone->freebytes + mainzone->purgablebytes;
+
+	// and the room left to grow before anything is purged
+	if(mainzone->size < zonelimit) free += zonelimit - mainzone->size;
 
-	for(block = mainzone->blocklist.next; block != &mainzone->blocklist;
-	    block = block->next) {
-		if(!block->user || block->tag >= PU_PURGELEVEL) free += block->size;
-	}
 	return free;
 }
+
+//
+// Z_LargestFree
+// Only the list of the largest blocks is searched.
+//
+static int Z_LargestFree(void) {
+	memblock_t *block;
+	int largest;
+	int word;
+
+	if(mainzone->largemap) {
+		largest = 0;
+		block = mainzone->largefree[31 - __builtin_clz(mainzone->largemap)];
+		for(; block; block = block->listnext) {
+			if(block->size > largest) largest = block->size;
+		}
+		return largest;
+	}
+
+	for(word = SMALLWORDS - 1; word >= 0; word--) {
+		if(mainzone->smallmap[word]) {
+			return ((word << 5) + 31 - __builtin_clz(mainzone->smallmap[word])) *
+			       ZONEALIGN;
+		}
+	}
+
+	return 0;
+}
+
+//
+// Z_Ticker
+//
+void Z_Ticker(void) {
+	static unsigned mallocs, frees, purges;
+	static unsigned long long purgedbytes;
+	int i;
+
+	zonestats.mapped = mainzone->size;
+	zonestats.free = mainzone->freebytes;
+	zonestats.purgable = mainzone->purgablebytes;
+	zonestats.largest = Z_LargestFree();
+
+	zonestats.ticmallocs = zonestats.mallocs - mallocs;
+	zonestats.ticfrees = zonestats.frees - frees;
+	zonestats.ticpurges = zonestats.purges - purges;
+	zonestats.ticpurgedbytes = zonestats.purgedbytes - purgedbytes;
+
+	mallocs = zonestats.mallocs;
+	frees = zonestats.frees;
+	purges = zonestats.purges;
+	purgedbytes = zonestats.purgedbytes;
+
+	if(!statsfile) return;
+
+	fprintf(statsfile, "%i,%i,%i,%i,%i,%i,%u,%u,%u,%u", gametic,
+	    zonestats.mapped, zonestats.free, zonestats.purgable,
+	    zonestats.largest,
+	    zonestats.free ?
+	        100 - (int) (100.0 * zonestats.largest / zonestats.free) : 0,
+	    zonestats.ticmallocs, zonestats.ticfrees, zonestats.ticpurges,
+	    zonestats.ticpurgedbytes);
+
+	for(i = 0; zonetags[i].name; i++) {
+		fprintf(statsfile, ",%i,%i", zonestats.tagbytes[zonetags[i].tag],
+		    zonestats.tagblocks[zonetags[i].tag]);
+	}
+
+	fprintf(statsfile, "\n");
+}
+
+//
+// Z_ReportFragmentation
+//
+void Z_ReportFragmentation(void) {
+	zoneregion_t *region;
+	memblock_t *block;
+	int blocks, used;
+	int freeblocks, largest;
+	int purgableblocks;
+	int regions;
+
+	blocks = used = freeblocks = largest = purgableblocks = regions = 0;
+
+	for(region = mainzone->regions; region; region = region->next) {
+		regions++;
+
+		for(block = region->blocklist.next; block != &region->blocklist;
+		    block = block->next) {
+			if(!block->user) {
+				freeblocks++;
+				if(block->size > largest) largest = block->size;
+				continue;
+			}
+
+			blocks++;
+			used += block->size;
+			if(block->tag >= PU_PURGELEVEL) purgableblocks++;
+		}
+	}
+
+	printf("Z_ReportFragmentation: %i bytes mapped in %i regions, "
+	       "soft limit %i\n",
+	    mainzone->size, regions, zonelimit);
+	printf("Z_ReportFragmentation: %i bytes in %i blocks, "
+	       "%i of them purgable in %i blocks\n",
+	    used, blocks, mainzone->purgablebytes, purgableblocks);
+	printf("Z_ReportFragmentation: %i bytes free in %i blocks, "
+	       "largest %i, %i%% fragmented\n",
+	    mainzone->freebytes, freeblocks, largest,
+	    mainzone->freebytes ?
+	        100 - (int) (100.0 * largest / mainzone->freebytes) : 0);
+}
+
+//
+// Z_Benchmark
+// -zonebench: Z_Malloc and Z_Free on a made up mix of thinkers,
+//  patches and flats, with a new level every so often.
+//
+#define BENCHSLOTS 4096
+#define BENCHOPS 2000000
+
+static unsigned benchseed = 1;
+
+static int Z_BenchRandom(void) {
+	benchseed = benchseed * 1103515245 + 12345;
+	return (benchseed >> 16) & 0x7fff;
+}
+
+void Z_Benchmark(void) {
+	static void *slots[BENCHSLOTS];
+	void *slot;
+	unsigned start, end, t;
+	unsigned worst;
+	int mallocs, frees;
+	int op, i, r;
+
+	mallocs = frees = 0;
+	worst = 0;
+	start = I_GetTimeUS();
+
+	for(op = 0; op < BENCHOPS; op++) {
+		if(op % (BENCHOPS / 8) == 0) Z_FreeTags(PU_LEVEL, PU_PURGELEVEL - 1);
+
+		i = Z_BenchRandom() % BENCHSLOTS;
+		slot = slots[i];
+		r = Z_BenchRandom() % 16;
+
+		t = I_GetTimeUS();
+		if(slot) {
+			Z_Free(slot);
+			frees++;
+		}
+		else {
+			mallocs++;
+			if(r < 12) Z_Malloc(100 + Z_BenchRandom() % 200, PU_LEVEL, &slots[i]);
+			else if(r < 15)
+				Z_Malloc(1000 + Z_BenchRandom() % 8000, PU_CACHE, &slots[i]);
+			else Z_Malloc(4096 + Z_BenchRandom() * 2, PU_CACHE, &slots[i]);
+		}
+		t = I_GetTimeUS() - t;
+		if(t > worst) worst = t;
+	}
+
+	end = I_GetTimeUS();
+
+	printf("Z_Benchmark: %i Z_Malloc, %i Z_Free in %u ms, "
+	       "%u ns per call, worst %u us\n",
+	    mallocs, frees, (end - start) / 1000,
+	    (unsigned) ((end - start) * 1000ull / BENCHOPS), worst);
+
+	Z_CheckHeap();
+	Z_ReportFragmentation();
+}
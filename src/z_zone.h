@@ -34,6 +34,7 @@
 #define PU_SOUND 2    // static while playing
 #define PU_MUSIC 3    // static while playing
 #define PU_DAVE 4     // anything else Dave wants static
+#define PU_PRELOAD 5  // read ahead for the next level
 #define PU_LEVEL 50   // static until level exited
 #define PU_LEVSPEC 51 // a special thinker in a level
 // Tags >= 100 are purgable whenever needed.
@@ -44,33 +45,102 @@ void Z_Init(void);
 void *Z_Malloc(int size, int tag, void *ptr);
 void Z_Free(void *ptr);
 void Z_FreeTags(int lowtag, int hightag);
+void Z_ReleaseRegions(void);
 void Z_DumpHeap(int lowtag, int hightag);
 void Z_FileDumpHeap(FILE *f);
 void Z_CheckHeap(void);
 void Z_ChangeTag2(void *ptr, int tag);
 int Z_FreeMemory(void);
+void Z_ReportFragmentation(void);
+void Z_Benchmark(void);
+void Z_Ticker(void);
+
+// If set, called before Z_Malloc throws out a purgable block.
+extern void (*purgefunc)(void);
+
+// Objects of one size that come and go all the time, like
+//  thinkers. They are cut from slabs with the pool's tag, so
+//  Z_FreeTags throws them all out together with the slabs.
+typedef struct zonepool_s {
+	int size; // of the objects
+	int tag;  // of the slabs
+
+	void *freelist;
+	int linked;
+	struct zonepool_s *next;
+} zonepool_t;
+
+void *Z_PoolAlloc(zonepool_t *pool);
+void Z_PoolFree(void *ptr);
+
+// Memory outside the zone that is handed out in place of
+//  zone blocks, like mapped WAD files.
+//  Z_Free and Z_ChangeTag leave pointers into it alone.
+//  Z_AddExternal returns 0 when it can't take another one.
+int Z_AddExternal(void *start, int size);
+int Z_IsExternal(void *ptr);
+
+#define NUMZONETAGS (PU_CACHE + 1)
+
+// Kept up to date by Z_Malloc, Z_Free and Z_ChangeTag,
+//  the zone wide numbers and the last tic's by Z_Ticker.
+typedef struct {
+	int tagbytes[NUMZONETAGS]; // headers included
+	int tagblocks[NUMZONETAGS];
+
+	int mapped;
+	int free;
+	int purgable;
+	int largest; // free block
+
+	// since startup, purges count as frees too,
+	//  they wrap around in long sessions
+	unsigned mallocs;
+	unsigned frees;
+	unsigned purges;
+	unsigned long long purgedbytes;
+
+	unsigned ticmallocs;
+	unsigned ticfrees;
+	unsigned ticpurges;
+	unsigned ticpurgedbytes;
+} zonestats_t;
+
+extern zonestats_t zonestats;
+
+typedef struct {
+	char *name;
+	int tag;
+} zonetag_t;
+
+// The named tags, ends with a NULL name
+extern zonetag_t zonetags[];
 
 typedef struct memblock_s {
 	int size;    // including the header and possibly tiny fragments
 	void **user; // NULL if a free block
 	int tag;     // purgelevel
 	int id;      // should be ZONEID
-	struct memblock_s *next;
+	struct memblock_s *next; // neighbours in memory
 	struct memblock_s *prev;
+	struct memblock_s *listnext; // size class list if free,
+	struct memblock_s *listprev; //  LRU list if purgable
 } memblock_t;
 
 //
 // This is used to get the local FILE:LINE info from CPP
 // prior to really call the function in question.
 //
-#define Z_ChangeTag(p, t)                                              \
-	{                                                                  \
-		if(((memblock_t *) ((byte *) (p) - sizeof(memblock_t)))->id != \
-		    0x1d4a11)                                                  \
-			I_Error("Z_CT at "__FILE__                                 \
-			        ":%i",                                             \
-			    __LINE__);                                             \
-		Z_ChangeTag2(p, t);                                            \
+#define Z_ChangeTag(p, t)                                                  \
+	{                                                                      \
+		if(!Z_IsExternal(p)) {                                             \
+			if(((memblock_t *) ((byte *) (p) - sizeof(memblock_t)))->id != \
+			    0x1d4a11)                                                  \
+				I_Error("Z_CT at "__FILE__                                 \
+				        ":%i",                                             \
+				    __LINE__);                                             \
+			Z_ChangeTag2(p, t);                                            \
+		}                                                                  \
 	};
 
 #endif